@@ -26,42 +26,106 @@
 
 #include <ctype.h>
     // Import isprint()
+    // Import toupper()
 #include <err.h>
     // Import err()
 #include <errno.h>
     // Import var errno
+    // Import constant ERANGE
+#include <limits.h>
+    // Import constant INT_MAX
+#include <poll.h>
+    // Import type struct pollfd
+    // Import constant POLLERR
+    // Import constant POLLIN
+    // Import poll()
+#include <pthread.h>
+    // Import type pthread_cond_t
+    // Import type pthread_mutex_t
+    // Import type pthread_t
+    // Import pthread_cond_wait()
+    // Import pthread_create()
+    // Import pthread_join()
+#include <signal.h>
+    // Import constant SIGPIPE
+    // Import constant SIG_DFL
+    // Import raise()
+    // Import signal()
 #include <stdbool.h>
     // Import type bool
     // Import constant false
     // Import constant true
 #include <stddef.h>
     // Import constant NULL
+#include <stdint.h>
+    // Import constant SIZE_MAX
 #include <stdio.h>
     // Import type FILE
     // Import fclose()
+    // Import fflush()
+    // Import fileno()
+    // Import fopencookie()
     // Import fopen()
     // Import fprintf()
     // Import fputc()
     // Import fputs()
+    // Import fwrite()
+    // Import open_memstream()
+    // Import setvbuf()
     // Import snprintf()
+    // Import sprintf()
     // Import var stdin
     // Import var stdout
 #include <stdlib.h>
     // Import exit()
     // Import free()
+    // Import getenv()
+    // Import mkstemp()
 #include <string.h>
-    // Import strdup()
+    // Import memcmp()
+    // Import memcpy()
+    // Import memmove()
+    // Import strchr()
+    // Import strcpy()
+    // Import strrchr()
+    // Import strerror()
+#include <sys/inotify.h>
+    // Import type struct inotify_event
+    // Import constant IN_CLOEXEC
+    // Import inotify_add_watch()
+    // Import inotify_init1()
+#include <sys/ioctl.h>
+    // Import type struct winsize
+    // Import constant TIOCGWINSZ
+    // Import ioctl()
+#include <sys/mman.h>
+    // Import madvise()
+    // Import mmap()
+    // Import munmap()
+#include <sys/stat.h>
+    // Import type struct stat
+    // Import fstat()
+    // Import S_ISFIFO()
+    // Import S_ISREG()
+#include <time.h>
+    // Import clock_gettime()
 #include <unistd.h>
+    // Import close()
     // Import getopt_long()
+    // Import isatty()
     // Import optarg()
     // Import opterr()
     // Import optind()
     // Import optopt()
+    // Import read()
+    // Import constant STDOUT_FILENO
+    // Import unlink()
+    // Import write()
     // Import type size_t
+    // Import type ssize_t
 
 #include <cscript.h>
-
-extern int mc(FILE *f, size_t nelem, const char **elemv, size_t llen, size_t indent, bool horizontal);
+#include <libmc.h>
 
 const char *program_path;
 const char *program_name;
@@ -77,7 +141,51 @@ static char *cmdpfx;
 static size_t width      = 0;
 static size_t indent     = 4;
 static bool   horizontal = false;
+static bool   auto_orientation = false;
+static bool   uniform = false;
 static bool   each_file  = false;
+static enum mc_engine engine = MC_ENGINE_DEFAULT;
+static size_t threads    = 1;
+static size_t max_rows   = 0;
+static bool   trailer    = false;
+static size_t page_elements = 0;
+static bool   stable_widths = false;
+static struct mc_widths page_widths;
+static size_t columns    = 0;
+static size_t col_width  = 0;
+static enum mc_overflow overflow = MC_OVERFLOW_TRUNCATE;
+static bool   grid_mode  = false;   // --columns or --col-width given
+static mc_grid_t grid;
+static bool   follow     = false;
+static size_t follow_ms  = 1000;
+static size_t window     = 0;
+static const char *watch_file = NULL;
+static size_t *widthv     = NULL;   // --widths
+static size_t nwidths     = 0;
+static bool   breakpoints = false;  // --breakpoints
+static size_t fit_rows    = 0;      // --max-rows-fit
+static size_t fixed_rows  = 0;      // --rows
+
+enum plan_mode {
+    PLAN_NONE,
+    PLAN_TEXT,
+    PLAN_JSON,
+};
+
+static enum plan_mode plan_mode = PLAN_NONE;   // --plan
+static char  *plan_category;    // With --plan=json, the current category, or NULL
+
+enum output_mode {
+    OUTPUT_AUTO,
+    OUTPUT_STDIO,
+    OUTPUT_WRITEV,
+    OUTPUT_SPLICE,
+};
+
+static enum output_mode output_mode = OUTPUT_STDIO;
+static int output_err = 0;
+static size_t write_buffers = 0;
+static FILE *out;               // stdout, or a stream into the writer thread
 
 FILE *errprint_fh = NULL;
 FILE *dbgprint_fh = NULL;
@@ -90,9 +198,32 @@ static struct option long_options[] = {
     {"argv",           no_argument,       0,  'A'},
     {"each-file",      no_argument,       0,  'E'},
     {"horizontal",     no_argument,       0,  'H'},
+    {"orientation",    required_argument, 0,  'Q'},
+    {"uniform",        no_argument,       0,  'X'},
     {"cmd",            required_argument, 0,  'c'},
     {"width",          required_argument, 0,  'w'},
     {"indent",         required_argument, 0,  'i'},
+    {"engine",         required_argument, 0,  'e'},
+    {"threads",        required_argument, 0,  't'},
+    {"output",         required_argument, 0,  'o'},
+    {"write-buffers",  required_argument, 0,  'B'},
+    {"max-rows",       required_argument, 0,  'R'},
+    {"trailer",        no_argument,       0,  'T'},
+    {"page-elements",  required_argument, 0,  'P'},
+    {"stable-widths",  no_argument,       0,  'S'},
+    {"columns",        required_argument, 0,  'C'},
+    {"col-width",      required_argument, 0,  'W'},
+    {"overflow",       required_argument, 0,  'O'},
+    {"memory-budget",  required_argument, 0,  'M'},
+    {"follow",         no_argument,       0,  'F'},
+    {"follow-interval", required_argument, 0, 'I'},
+    {"window",         required_argument, 0,  'N'},
+    {"watch",          required_argument, 0,  'U'},
+    {"widths",         required_argument, 0,  'D'},
+    {"breakpoints",    no_argument,       0,  'K'},
+    {"max-rows-fit",   required_argument, 0,  'Y'},
+    {"rows",           required_argument, 0,  'G'},
+    {"plan",           optional_argument, 0,  'L'},
     {0, 0, 0, 0}
 };
 
@@ -105,9 +236,61 @@ static const char usage_text[] =
     "  --argv               Input is argv, instead of from files\n"
     "  --each-file|-E       Break and print after each file\n"
     "  --horizontal|-H      Print elements along rows first\n"
+    "  --orientation <o>    vertical (default), horizontal, or auto:\n"
+    "                       for each category, whichever takes fewer rows\n"
+    "  --uniform            Make all columns as wide as the longest element\n"
     "  --cmd|c <str>        Command prefix\n"
     "  --width|w <n>        display width (AKA line length)\n"
     "  --indent|i <n>       Indentation (number of spaces)\n"
+    "  --engine <name>      Layout engine: full, prune, descend, sample\n"
+    "  --threads <n>        Render rows with <n> threads (0: one per CPU)\n"
+    "  --output <mode>      stdio (default): render rows through stdio;\n"
+    "                       writev: write elements from where they lie;\n"
+    "                       splice: give rendered pages to a pipe;\n"
+    "                       auto: splice into a pipe, from the writer\n"
+    "                       thread if there is one; stdio otherwise\n"
+    "  --write-buffers <n>  In stdio mode, write from a separate thread,\n"
+    "                       with <n> 256K buffers (default 0; under 2: no thread)\n"
+    "  --max-rows <n>       Print at most <n> rows of each category\n"
+    "  --trailer            After rows left out, say how many elements were\n"
+    "                       not shown\n"
+    "  --page-elements <n>  Lay out and print every <n> elements of a category\n"
+    "                       as a page of their own, as soon as they are read\n"
+    "  --stable-widths      With pages, keep the column widths of the previous\n"
+    "                       page, as long as its elements fit them\n"
+    "  --columns <n>        Fixed grid of <n> columns, across rows; each\n"
+    "                       element is written as soon as it is read\n"
+    "  --col-width <n>      Fixed grid with columns <n> wide; with only one\n"
+    "                       of --columns and --col-width, the other is\n"
+    "                       derived from --width\n"
+    "  --overflow <policy>  Elements wider than a grid column:\n"
+    "                       truncate (default), or span more columns\n"
+    "  --memory-budget <n>  Spill a category that takes more than <n> bytes\n"
+    "                       (suffix K, M or G) of memory to temporary files\n"
+    "  --follow             Keep reading as input grows, as tail -f does,\n"
+    "                       and show the layout so far, again and again\n"
+    "  --follow-interval <ms>  While it grows, show it again every <ms>\n"
+    "                       milliseconds (default 1000), and whenever its\n"
+    "                       number of columns changes\n"
+    "  --window <n>         --follow, but show only the last <n> elements\n"
+    "                       of a category, and keep only those in memory\n"
+    "  --watch <file>       Show <file>, and show it again each time it\n"
+    "                       changes, rewriting only the rows that changed\n"
+    "  --widths <n>,<n>...  Lay out each category at each of these display\n"
+    "                       widths, all at once, and print it at each,\n"
+    "                       after a line \"width <n>:\"\n"
+    "  --breakpoints        Instead of each category, print its layout at\n"
+    "                       every display width up to --width, as the\n"
+    "                       ranges of widths over which it stays the same\n"
+    "  --max-rows-fit <n>   Print each category at the narrowest width, up\n"
+    "                       to --width, at which it takes at most <n> rows,\n"
+    "                       after a line \"width <w>:\"\n"
+    "  --rows <n>           Print each category in at most <n> rows, with\n"
+    "                       as few columns as that allows, however wide,\n"
+    "                       after a line \"width <w>:\" giving its width\n"
+    "  --plan[=json]        Instead of each category, print only its layout:\n"
+    "                       columns, rows, orientation and column widths,\n"
+    "                       on one line, or as one JSON object per line\n"
     "\n"
     "The only command is \"category\".  A new category\n"
     "causes mcml to break, print all data collected so far,\n"
@@ -157,6 +340,78 @@ usage(void)
     eprint(usage_text);
 }
 
+/*
+ * Parse a number of bytes, with an optional suffix, K, M or G,
+ * for a power of 1024.  A size that does not fit in a size_t
+ * is rejected with ERANGE.
+ */
+
+static int
+parse_size(size_t *r, const char *str)
+{
+    static const char suffixes[] = "KMG";
+    const char *sfx;
+    char *copy;
+    size_t len;
+    size_t n;
+    int shift;
+    int rv;
+
+    len = strlen(str);
+    copy = (char *) guard_malloc(len + 1);
+    strcpy(copy, str);
+    sfx = NULL;
+    if (len > 1) {
+        sfx = strchr(suffixes, toupper((unsigned char) copy[len - 1]));
+    }
+    if (sfx != NULL) {
+        copy[len - 1] = '\0';
+    }
+    rv = parse_cardinal(&n, copy);
+    free(copy);
+    if (rv != 0) {
+        return (rv);
+    }
+    shift = sfx != NULL ? 10 * (sfx - suffixes + 1) : 0;
+    if (n > (SIZE_MAX >> shift)) {
+        return (ERANGE);
+    }
+    *r = n << shift;
+    return (0);
+}
+
+/*
+ * Parse a comma-separated list of display widths, for --widths.
+ */
+
+static int
+parse_widths(const char *str)
+{
+    char *copy;
+    char *p;
+    int rv = 0;
+
+    copy = (char *) guard_malloc(strlen(str) + 1);
+    strcpy(copy, str);
+    nwidths = 0;
+    for (p = copy; rv == 0 && p != NULL; ) {
+        char *comma = strchr(p, ',');
+
+        if (comma != NULL) {
+            *comma = '\0';
+        }
+        widthv = (size_t *) guard_realloc(widthv, (nwidths + 1) * sizeof (*widthv));
+        rv = parse_cardinal(&widthv[nwidths], p);
+        if (rv == 0 && widthv[nwidths] == 0) {
+            rv = EINVAL;
+        }
+        ++nwidths;
+        p = comma != NULL ? comma + 1 : NULL;
+    }
+    free(copy);
+    return (rv);
+}
+
 static inline bool
 is_long_option(const char *s)
 {
@@ -176,93 +431,1326 @@ vischar_r(char *buf, size_t sz, int c)
     return (buf);
 }
 
-static char **mc_elemv;
+// ################ async writer
+
+/*
+ * With --write-buffers 2 or more, output in stdio mode does not go
+ * straight to stdout.  It goes through a stream whose bytes are
+ * collected in fixed-size chunks, and a writer thread writes full
+ * chunks to the output, in order.  So reading, layout and rendering
+ * of the next category overlap the write of the previous one.  There
+ * is a fixed number of chunks; once they are all full, the producer
+ * waits for the writer to free one, so memory is bounded however slow
+ * the consumer is.
+ *
+ * The first write error (ENOSPC, say, or EPIPE if mcml was started
+ * with SIGPIPE ignored) is remembered, later output is discarded, and
+ * the error is reported in the exit status once all output has been
+ * handed over.
+ *
+ * With --output auto, when the output is a pipe, the writer gives
+ * chunks to the pipe with vmsplice(2), rather than copying them, by
+ * way of mc_splice_out(), as libmc does for --output splice.  A
+ * spliced chunk may still be referenced by the kernel, so it is never
+ * written again: its pages are unmapped and replaced with fresh ones
+ * before it is reused.
+ */
+
+#define OUTQ_CHUNK (256 * 1024)
+
+struct outq_chunk {
+    struct outq_chunk *next;
+    size_t len;
+    char *data;                 // OUTQ_CHUNK bytes, page aligned
+};
+
+struct outq {
+    int fd;
+    int err;
+    bool splice;                // Try vmsplice() first
+    bool closing;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t queued;      // A chunk was queued, or closing
+    pthread_cond_t freed;       // A chunk was freed
+    struct outq_chunk *head;    // Full chunks, oldest first
+    struct outq_chunk *tail;
+    struct outq_chunk *free;    // Chunks available to fill
+    struct outq_chunk *cur;     // Chunk being filled
+    size_t busy;                // Chunks queued or being written
+};
+
+static struct outq outq;
+
+static char *
+outq_map_chunk(void)
+{
+    void *p;
+
+    p = mmap(NULL, OUTQ_CHUNK, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        eprintf("%s: mmap of output buffer failed\n", program_name);
+        exit(2);
+    }
+    return ((char *) p);
+}
+
+static void
+outq_write_chunk(struct outq *q, struct outq_chunk *c)
+{
+    bool use_write = !q->splice;
+    bool spliced = false;
+    int err;
+
+    if (q->err != 0) {
+        return;
+    }
+    err = mc_splice_out(q->fd, c->data, c->len, &use_write, &spliced);
+    q->splice = !use_write;
+    if (err != 0) {
+        // Only this thread sets err; others read it under the lock
+        pthread_mutex_lock(&q->lock);
+        q->err = err;
+        pthread_mutex_unlock(&q->lock);
+    }
+
+    if (spliced) {
+        munmap(c->data, OUTQ_CHUNK);
+        c->data = outq_map_chunk();
+    }
+}
+
+static void *
+outq_writer(void *arg)
+{
+    struct outq *q = (struct outq *) arg;
+
+    pthread_mutex_lock(&q->lock);
+    while (true) {
+        struct outq_chunk *c;
+
+        while (q->head == NULL && !q->closing) {
+            pthread_cond_wait(&q->queued, &q->lock);
+        }
+        c = q->head;
+        if (c == NULL) {
+            break;
+        }
+        q->head = c->next;
+        if (q->head == NULL) {
+            q->tail = NULL;
+        }
+        pthread_mutex_unlock(&q->lock);
+
+        outq_write_chunk(q, c);
+
+        pthread_mutex_lock(&q->lock);
+        c->len = 0;
+        c->next = q->free;
+        q->free = c;
+        --q->busy;
+        pthread_cond_broadcast(&q->freed);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return (NULL);
+}
+
+/*
+ * Queue the chunk being filled, if it has anything in it,
+ * and wait for a free one to fill next.
+ */
+
+static void
+outq_push(struct outq *q)
+{
+    pthread_mutex_lock(&q->lock);
+    if (q->cur != NULL && q->cur->len != 0) {
+        q->cur->next = NULL;
+        if (q->tail != NULL) {
+            q->tail->next = q->cur;
+        }
+        else {
+            q->head = q->cur;
+        }
+        q->tail = q->cur;
+        ++q->busy;
+        q->cur = NULL;
+        pthread_cond_signal(&q->queued);
+    }
+    if (q->cur == NULL) {
+        while (q->free == NULL) {
+            pthread_cond_wait(&q->freed, &q->lock);
+        }
+        q->cur = q->free;
+        q->free = q->cur->next;
+    }
+    pthread_mutex_unlock(&q->lock);
+}
+
+static ssize_t
+outq_cookie_write(void *cookie, const char *buf, size_t size)
+{
+    struct outq *q = (struct outq *) cookie;
+    size_t done = 0;
+
+    while (done < size) {
+        struct outq_chunk *c = q->cur;
+        size_t n = size - done;
+
+        if (n > OUTQ_CHUNK - c->len) {
+            n = OUTQ_CHUNK - c->len;
+        }
+        memcpy(c->data + c->len, buf + done, n);
+        c->len += n;
+        done += n;
+        if (c->len == OUTQ_CHUNK) {
+            outq_push(q);
+        }
+    }
+    return (size);
+}
+
+static void
+outq_free_chunks(struct outq *q)
+{
+    while (q->free != NULL) {
+        struct outq_chunk *next = q->free->next;
+
+        munmap(q->free->data, OUTQ_CHUNK);
+        free(q->free);
+        q->free = next;
+    }
+}
+
+static int
+outq_cookie_close(void *cookie)
+{
+    struct outq *q = (struct outq *) cookie;
+
+    outq_push(q);
+    pthread_mutex_lock(&q->lock);
+    q->closing = true;
+    pthread_cond_signal(&q->queued);
+    pthread_mutex_unlock(&q->lock);
+    pthread_join(q->thread, NULL);
+
+    q->cur->next = q->free;
+    q->free = q->cur;
+    q->cur = NULL;
+    outq_free_chunks(q);
+    return (0);
+}
+
+/*
+ * Open a stream that writes to |fd| through a writer thread,
+ * with |nchunks| chunks of buffer space, splicing if |splice|.
+ * Return NULL if the writer thread cannot be started;
+ * the caller then just uses stdout.
+ */
+
+static FILE *
+outq_open(struct outq *q, int fd, size_t nchunks, bool splice)
+{
+    cookie_io_functions_t io = {
+        NULL,
+        outq_cookie_write,
+        NULL,
+        outq_cookie_close,
+    };
+    FILE *f;
+    size_t i;
+
+    q->fd = fd;
+    q->err = 0;
+    q->splice = splice;
+    q->closing = false;
+    q->head = NULL;
+    q->tail = NULL;
+    q->free = NULL;
+    q->busy = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->queued, NULL);
+    pthread_cond_init(&q->freed, NULL);
+
+    for (i = 0; i < nchunks; ++i) {
+        struct outq_chunk *c;
+
+        c = (struct outq_chunk *) guard_malloc(sizeof (*c));
+        c->data = outq_map_chunk();
+        c->len = 0;
+        c->next = q->free;
+        q->free = c;
+    }
+    q->cur = q->free;
+    q->free = q->cur->next;
+
+    if (pthread_create(&q->thread, NULL, outq_writer, q) != 0) {
+        q->cur->next = q->free;
+        q->free = q->cur;
+        q->cur = NULL;
+        outq_free_chunks(q);
+        return (NULL);
+    }
+
+    f = fopencookie(q, "w", io);
+    if (f == NULL) {
+        outq_cookie_close(q);
+        return (NULL);
+    }
+    setvbuf(f, NULL, _IOFBF, 64 * 1024);
+    return (f);
+}
+
+// ################ element storage
+
+/*
+ * Elements are kept as pointers and lengths, and are not
+ * nul-terminated, so that they can point straight into a file
+ * mapping.  Lines read into a buffer are copied into an arena,
+ * a few large chunks, rather than one heap block per line.
+ * Everything is let go in mc_reset(), after each flush.
+ */
+
+static const char **mc_elemv;
+static size_t *mc_lenv;
 static size_t mc_nelem;
 static size_t mc_sz;
+static size_t mc_bytes;         // Heap bytes held for the current category
+static size_t memory_budget = 0;
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t siz;
+    size_t used;
+    char data[];
+};
+
+#define ARENA_CHUNK (1024 * 1024)
+
+static struct arena_chunk *arena;
+
+/*
+ * File mappings whose lines may still be referenced by elements.
+ * A mapping is put on this list only once its file has been read,
+ * so mc_reset() never unmaps the file that is being read.
+ */
+
+struct mapping {
+    struct mapping *next;
+    void *addr;
+    size_t len;
+};
+
+static struct mapping *mappings;
+
+/*
+ * Copy |len| bytes into the arena, and nul-terminate the copy.
+ */
+
+static char *
+arena_copy(const char *p, size_t len)
+{
+    char *copy;
+
+    mc_bytes += len + 1;
+    if (arena == NULL || arena->siz - arena->used < len + 1) {
+        size_t siz = len + 1 > ARENA_CHUNK ? len + 1 : ARENA_CHUNK;
+        struct arena_chunk *chunk;
+
+        chunk = (struct arena_chunk *) guard_malloc(sizeof (*chunk) + siz);
+        chunk->next = arena;
+        chunk->siz = siz;
+        chunk->used = 0;
+        arena = chunk;
+    }
+
+    copy = arena->data + arena->used;
+    memcpy(copy, p, len);
+    copy[len] = '\0';
+    arena->used += len + 1;
+    return (copy);
+}
 
 static void
-mc_add_element(const char *elem)
+mapping_retain(void *addr, size_t len)
 {
-    if (mc_sz == 0) {
-        size_t bytes;
+    struct mapping *m;
+
+    m = (struct mapping *) guard_malloc(sizeof (*m));
+    m->addr = addr;
+    m->len = len;
+    m->next = mappings;
+    mappings = m;
+}
+
+// ################ spill files
+
+/*
+ * With --memory-budget, once the elements of a category take up more
+ * heap than the budget, the category is spilled.  The bytes of its
+ * elements are appended to one temporary file, back to back, and their
+ * lengths to another, and nothing of the category is kept in the heap.
+ * When the category is flushed, both files are mapped.  libmc lays out
+ * from the mapped lengths, and prints from the mapped bytes (see
+ * opt.packed), so how much of a category is resident at any time
+ * is up to the page cache, not the size of the input.
+ */
+
+struct spill {
+    int    fd;
+    char   *buf;        // Write buffer, SPILL_BUF bytes
+    size_t len;         // Bytes in buf
+    size_t size;        // Bytes in the file, and in buf
+    void   *map;
+};
+
+#define SPILL_BUF (1024 * 1024)
 
+static bool spilling = false;
+static struct spill spill_bytes;
+static struct spill spill_lens;
+
+static void
+spill_open(struct spill *sp)
+{
+    const char *tmpdir = getenv("TMPDIR");
+    char *path;
+
+    if (tmpdir == NULL || *tmpdir == '\0') {
+        tmpdir = "/tmp";
+    }
+    path = (char *) guard_malloc(strlen(tmpdir) + sizeof ("/mcml.XXXXXX"));
+    sprintf(path, "%s/mcml.XXXXXX", tmpdir);
+    sp->fd = mkstemp(path);
+    if (sp->fd < 0) {
+        eprintf("%s: cannot create spill file in %s: %s\n",
+            program_name, tmpdir, strerror(errno));
+        exit(2);
+    }
+    unlink(path);
+    free(path);
+    sp->buf = (char *) guard_malloc(SPILL_BUF);
+    sp->len = 0;
+    sp->size = 0;
+    sp->map = NULL;
+}
+
+static void
+spill_drain(struct spill *sp)
+{
+    const char *p = sp->buf;
+    size_t len = sp->len;
+
+    while (len != 0) {
+        ssize_t rv = write(sp->fd, p, len);
+
+        if (rv < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            eprintf("%s: write to spill file failed: %s\n",
+                program_name, strerror(errno));
+            exit(2);
+        }
+        p += rv;
+        len -= rv;
+    }
+    sp->len = 0;
+}
+
+static void
+spill_write(struct spill *sp, const void *p, size_t len)
+{
+    sp->size += len;
+    while (len != 0) {
+        size_t n = SPILL_BUF - sp->len;
+
+        if (n > len) {
+            n = len;
+        }
+        memcpy(sp->buf + sp->len, p, n);
+        sp->len += n;
+        p = (const char *) p + n;
+        len -= n;
+        if (sp->len == SPILL_BUF) {
+            spill_drain(sp);
+        }
+    }
+}
+
+/*
+ * Map everything written so far.
+ */
+
+static const void *
+spill_map(struct spill *sp)
+{
+    static const char empty[1];
+
+    spill_drain(sp);
+    if (sp->size == 0) {
+        return (empty);
+    }
+    sp->map = mmap(NULL, sp->size, PROT_READ, MAP_SHARED, sp->fd, 0);
+    if (sp->map == MAP_FAILED) {
+        eprintf("%s: mmap of spill file failed: %s\n", program_name, strerror(errno));
+        exit(2);
+    }
+    madvise(sp->map, sp->size, MADV_WILLNEED);
+    return (sp->map);
+}
+
+static void
+spill_close(struct spill *sp)
+{
+    if (sp->map != NULL) {
+        munmap(sp->map, sp->size);
+    }
+    close(sp->fd);
+    free(sp->buf);
+}
+
+/*
+ * Let go of the storage of the elements added so far: the arena,
+ * the file mappings they point into, and, if |arrays|, the arrays.
+ */
+
+static void
+release_elements(bool arrays)
+{
+    while (arena != NULL) {
+        struct arena_chunk *next = arena->next;
+        free(arena);
+        arena = next;
+    }
+    while (mappings != NULL) {
+        struct mapping *next = mappings->next;
+        munmap(mappings->addr, mappings->len);
+        free(mappings);
+        mappings = next;
+    }
+    mc_bytes = 0;
+    if (arrays) {
+        free(mc_elemv);
+        free(mc_lenv);
+        mc_elemv = NULL;
+        mc_lenv = NULL;
+        mc_sz = 0;
+    }
+}
+
+/*
+ * Spill the current category: write out the elements added so far,
+ * and let go of the heap they took up.
+ */
+
+static void
+spill_start(void)
+{
+    size_t enr;
+
+    spill_open(&spill_bytes);
+    spill_open(&spill_lens);
+    for (enr = 0; enr < mc_nelem; ++enr) {
+        spill_write(&spill_bytes, mc_elemv[enr], mc_lenv[enr]);
+    }
+    spill_write(&spill_lens, mc_lenv, mc_nelem * sizeof (*mc_lenv));
+    release_elements(true);
+    spilling = true;
+}
+
+/*
+ * Add an element of |len| bytes.  Unless |lasting|, the bytes are only
+ * valid until the next line is read, and must be copied.
+ */
+
+static void
+mc_add_element(const char *elem, size_t len, bool lasting)
+{
+    if (spilling) {
+        spill_write(&spill_bytes, elem, len);
+        spill_write(&spill_lens, &len, sizeof (len));
+        ++mc_nelem;
+        return;
+    }
+
+    if (mc_sz == 0) {
         mc_sz = 1024;
-        bytes = mc_sz * sizeof (*mc_elemv);
-        mc_elemv = (char **) guard_malloc(bytes);
+        mc_elemv = (const char **) guard_malloc(mc_sz * sizeof (*mc_elemv));
+        mc_lenv = (size_t *) guard_malloc(mc_sz * sizeof (*mc_lenv));
         mc_nelem = 0;
     }
 
     if (mc_nelem >= mc_sz) {
-        size_t bytes;
-
-        mc_sz += 1024;
-        bytes = mc_sz * sizeof (*mc_elemv);
-        mc_elemv = (char **) guard_realloc(mc_elemv, bytes);
+        mc_sz *= 2;
+        mc_elemv = (const char **) guard_realloc(mc_elemv, mc_sz * sizeof (*mc_elemv));
+        mc_lenv = (size_t *) guard_realloc(mc_lenv, mc_sz * sizeof (*mc_lenv));
     }
 
-    mc_elemv[mc_nelem] = strdup(elem);
+    mc_elemv[mc_nelem] = lasting ? elem : arena_copy(elem, len);
+    mc_lenv[mc_nelem] = len;
     ++mc_nelem;
+    mc_bytes += sizeof (*mc_elemv) + sizeof (*mc_lenv);
+
+    if (memory_budget != 0 && mc_bytes > memory_budget) {
+        spill_start();
+    }
 }
 
 void
 mc_reset(void)
 {
-    size_t i;
-
-    for (i = 0; i < mc_nelem; ++i) {
-        free(mc_elemv[i]);
+    if (spilling) {
+        spill_close(&spill_bytes);
+        spill_close(&spill_lens);
+        spilling = false;
     }
+    // Under a budget, do not hold on to arrays sized for a big category
+    release_elements(memory_budget != 0);
     mc_nelem = 0;
 }
 
+/*
+ * Layout options, from the command line.
+ */
+
+static void
+mcml_opt(mc_opt_t *opt)
+{
+    mc_opt_init(opt);
+    opt->llen = width;
+    opt->indent = indent;
+    opt->horizontal = horizontal;
+    opt->auto_orientation = auto_orientation;
+    opt->uniform = uniform;
+    opt->engine = engine;
+    opt->threads = threads;
+    opt->max_rows = max_rows;
+    opt->trailer = trailer;
+}
+
+/*
+ * With --watch, each category keeps the lengths of its elements and
+ * its last layout, from one showing of the file to the next.  While
+ * the lengths do not change, no layout pass is run.  Any other change
+ * lays the category out afresh, so what is shown is always what
+ * mcml would show for the file as it is.
+ */
+
+static struct mc_cache *watch_caches;   // One per category, in order
+static size_t watch_ncat;
+static size_t watch_cat;                // The category being read
+
+static struct mc_cache *
+watch_cache(void)
+{
+    if (watch_cat >= watch_ncat) {
+        size_t ncat = watch_cat + 8;
+        size_t i;
+
+        watch_caches = (struct mc_cache *) guard_realloc(watch_caches,
+            ncat * sizeof (*watch_caches));
+        for (i = watch_ncat; i < ncat; ++i) {
+            mc_cache_init(&watch_caches[i]);
+        }
+        watch_ncat = ncat;
+    }
+    return (&watch_caches[watch_cat]);
+}
+
+// ################ follow
+
+/*
+ * With --follow, the current category is shown over and over, as it
+ * grows: a frame at a time, each frame the layout of all elements
+ * read so far.  A new frame is shown when the number of columns
+ * changes, or once --follow-interval has passed since the last
+ * frame, if anything was added; also while waiting for input.
+ * The layout is kept up to date as each element is added
+ * (see mc_follow_add()), so a frame costs only its printing.
+ *
+ * On a terminal, each frame replaces the last one.  Otherwise,
+ * frames follow one another, separated by an empty line.
+ *
+ * With --window, only the last --window elements of a category are
+ * kept, each in a block of its own, freed as it leaves the window,
+ * so memory stays bounded however long the input runs.  They are kept
+ * in an array twice the size of the window, and slid back to its
+ * front when they reach its end, so that the window is always
+ * contiguous, as mc_print() wants it, at O(1) cost per element,
+ * amortized.
+ */
+
+static mc_follow_t *follow_fl;
+static size_t follow_cols;      // Columns of the last frame; 0: none yet
+static double follow_due;       // When the next frame is due
+static bool   follow_dirty;     // Something new since the last frame
+static char  *follow_category;  // Header of the current category, or NULL
+static bool   follow_tty;
+static size_t follow_frames;
+static size_t follow_added;     // Elements added to the current category
+
+static char  **win_elemv;
+static size_t *win_lenv;
+static size_t  win_beg;
+static size_t  win_nelem;
+
+static void
+window_add(const char *elem, size_t len)
+{
+    char *copy;
+
+    if (win_elemv == NULL) {
+        win_elemv = (char **) guard_malloc(2 * window * sizeof (*win_elemv));
+        win_lenv = (size_t *) guard_malloc(2 * window * sizeof (*win_lenv));
+    }
+    if (win_nelem == window) {
+        free(win_elemv[win_beg]);
+        ++win_beg;
+        --win_nelem;
+    }
+    if (win_beg + win_nelem == 2 * window) {
+        memmove(win_elemv, win_elemv + win_beg, win_nelem * sizeof (*win_elemv));
+        memmove(win_lenv, win_lenv + win_beg, win_nelem * sizeof (*win_lenv));
+        win_beg = 0;
+    }
+
+    copy = (char *) guard_malloc(len + 1);
+    memcpy(copy, elem, len);
+    copy[len] = '\0';
+    win_elemv[win_beg + win_nelem] = copy;
+    win_lenv[win_beg + win_nelem] = len;
+    ++win_nelem;
+}
+
+static void
+window_reset(void)
+{
+    size_t enr;
+
+    for (enr = win_beg; enr < win_beg + win_nelem; ++enr) {
+        free(win_elemv[enr]);
+    }
+    win_beg = 0;
+    win_nelem = 0;
+}
+
+static double
+now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6);
+}
+
+static void
+follow_frame(void)
+{
+    mc_opt_t opt;
+    int err;
+
+    if (output_err != 0) {
+        return;
+    }
+    if (follow_tty) {
+        fputs("\033[H\033[2J", out);
+    }
+    else if (follow_frames != 0) {
+        fputc('\n', out);
+    }
+    if (follow_category != NULL) {
+        fprintf(out, "%s:\n", follow_category);
+    }
+    if (follow_fl != NULL) {
+        mcml_opt(&opt);
+        opt.window = window;
+        if (window != 0) {
+            opt.lengths = win_lenv + win_beg;
+            err = mc_follow_print(follow_fl, out, win_nelem,
+                (const char **) win_elemv + win_beg, &opt);
+        }
+        else {
+            opt.lengths = mc_lenv;
+            err = mc_follow_print(follow_fl, out, mc_nelem, mc_elemv, &opt);
+        }
+        if (err != 0 && output_err == 0) {
+            output_err = err;
+        }
+        follow_cols = mc_follow_columns(follow_fl);
+    }
+    fflush(out);
+    ++follow_frames;
+    follow_dirty = false;
+    follow_due = now_ms() + follow_ms;
+}
+
+static void
+follow_add(size_t len)
+{
+    size_t cols;
+
+    if (follow_fl == NULL) {
+        mc_opt_t opt;
+
+        mcml_opt(&opt);
+        opt.window = window;
+        follow_fl = mc_follow_new(&opt);
+        follow_cols = 0;
+        follow_added = 0;
+    }
+    mc_follow_add(follow_fl, len);
+    follow_dirty = true;
+
+    cols = mc_follow_columns(follow_fl);
+    if (cols != follow_cols || (++follow_added % 256 == 0 && now_ms() >= follow_due)) {
+        follow_frame();
+    }
+}
+
+/*
+ * Wait up to |ms| milliseconds for input on |fd|, if it is not -1.
+ * Return 1 if there is input, 0 if there was none in time,
+ * or -1 if the reader at the other end of stdout has gone away.
+ */
+
+static int
+follow_poll(int fd, double ms)
+{
+    struct pollfd pfd[2];
+
+    pfd[0].fd = STDOUT_FILENO;
+    pfd[0].events = 0;
+    pfd[0].revents = 0;
+    pfd[1].fd = fd;
+    pfd[1].events = POLLIN;
+    pfd[1].revents = 0;
+    if (poll(pfd, 2, ms < 0 ? -1 : ms > INT_MAX ? INT_MAX : (int) ms + 1) <= 0) {
+        return (0);
+    }
+    if (pfd[0].revents & POLLERR) {
+        if (output_err == 0) {
+            output_err = EPIPE;
+        }
+        return (-1);
+    }
+    return (pfd[1].revents != 0);
+}
+
+/*
+ * Print the current category with |opt|, by whichever output path
+ * was chosen.
+ */
+
+static int
+mcml_print(mc_opt_t *opt)
+{
+    const char **elemv = spilling ? NULL : mc_elemv;
+
+    if (output_mode == OUTPUT_WRITEV || output_mode == OUTPUT_SPLICE) {
+        fflush(out);
+        opt->splice = (output_mode == OUTPUT_SPLICE);
+        return (mc_write(STDOUT_FILENO, mc_nelem, elemv, opt));
+    }
+    return (mc_print(out, mc_nelem, elemv, opt));
+}
+
+/*
+ * Print the current category with the layout of |plan|, at display
+ * width |llen|, after a line "width N:", for the width of the plan.
+ * The widths of the plan go to mc_print() as the widths to keep,
+ * so printing runs no layout of its own.
+ */
+
+static int
+mcml_print_plan(mc_opt_t *opt, struct mc_plan *plan, size_t llen)
+{
+    struct mc_widths kept;
+    int err;
+
+    kept.cols = plan->cols;
+    kept.widths = plan->widths;
+    kept.alloc = plan->cols;
+    opt->llen = llen;
+    opt->stable = &kept;
+    fprintf(out, "width %zu:\n", plan->llen);
+    err = mcml_print(opt);
+    plan->widths = kept.widths;
+    return (err);
+}
+
+/*
+ * With --widths, lay out the current category at all widths at once,
+ * with mc_plans(), then print it at each, in the order given.
+ */
+
+static int
+mcml_print_widths(mc_opt_t *opt)
+{
+    struct mc_plan *plans;
+    size_t k;
+    int err = 0;
+
+    plans = (struct mc_plan *) guard_malloc(nwidths * sizeof (*plans));
+    for (k = 0; k < nwidths; ++k) {
+        plans[k].llen = widthv[k];
+    }
+    mc_plans(mc_nelem, spilling ? NULL : mc_elemv, opt, nwidths, plans);
+
+    for (k = 0; k < nwidths && err == 0; ++k) {
+        err = mcml_print_plan(opt, &plans[k], plans[k].llen);
+    }
+
+    for (k = 0; k < nwidths; ++k) {
+        mc_plan_fini(&plans[k]);
+    }
+    free(plans);
+    return (err);
+}
+
+/*
+ * With --max-rows-fit, print the current category at the narrowest
+ * width, up to --width, at which it takes at most that many rows;
+ * or, if there is none, at --width.
+ */
+
+static int
+mcml_print_fit(mc_opt_t *opt)
+{
+    struct mc_plan plan;
+    int err;
+
+    if (mc_fit_rows(mc_nelem, spilling ? NULL : mc_elemv, opt, fit_rows, &plan) != 0) {
+        eprintf("%s: no width up to %zu fits in %zu rows\n",
+            program_name, opt->llen, fit_rows);
+        return (mcml_print(opt));
+    }
+    err = mcml_print_plan(opt, &plan, plan.llen);
+    mc_plan_fini(&plan);
+    return (err);
+}
+
+/*
+ * With --rows, print the current category in at most that many rows.
+ * The width of the plan is that of its lines, which mc_print() only
+ * takes as fitting in a display one column wider.
+ */
+
+static int
+mcml_print_rows(mc_opt_t *opt)
+{
+    struct mc_plan plan;
+    int err;
+
+    mc_plan_rows(mc_nelem, spilling ? NULL : mc_elemv, opt, fixed_rows, &plan);
+    err = mcml_print_plan(opt, &plan, plan.llen + 1);
+    mc_plan_fini(&plan);
+    return (err);
+}
+
+/*
+ * Write |str| as a JSON string.
+ */
+
+static void
+json_string(FILE *f, const char *str)
+{
+    const unsigned char *p;
+
+    fputc('"', f);
+    for (p = (const unsigned char *) str; *p; ++p) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', f);
+            fputc(*p, f);
+        }
+        else if (*p < 0x20) {
+            fprintf(f, "\\u%04x", *p);
+        }
+        else {
+            fputc(*p, f);
+        }
+    }
+    fputc('"', f);
+}
+
+/*
+ * With --plan, print the layout of the current category, without
+ * the category itself: "<cols> x <rows> <orientation>: <widths>",
+ * or, with --plan=json, a JSON object with the same, and the name
+ * of the category, on one line.
+ */
+
+static int
+mcml_print_layout(mc_opt_t *opt)
+{
+    struct mc_plan plan;
+    const char *orientation;
+    size_t col;
+
+    mc_plan(mc_nelem, spilling ? NULL : mc_elemv, opt, &plan);
+    orientation = plan.horizontal ? "horizontal" : "vertical";
+    if (plan_mode == PLAN_JSON) {
+        fputs("{\"category\":", out);
+        if (plan_category != NULL) {
+            json_string(out, plan_category);
+        }
+        else {
+            fputs("null", out);
+        }
+        fprintf(out, ",\"cols\":%zu,\"rows\":%zu,\"orientation\":\"%s\",\"widths\":[",
+            plan.cols, plan.rows, orientation);
+        for (col = 0; col < plan.cols; ++col) {
+            fprintf(out, col == 0 ? "%zu" : ",%zu", plan.widths[col]);
+        }
+        fputs("]}\n", out);
+    }
+    else {
+        fprintf(out, "%zu x %zu %s:", plan.cols, plan.rows, orientation);
+        for (col = 0; col < plan.cols; ++col) {
+            fprintf(out, " %zu", plan.widths[col]);
+        }
+        fputc('\n', out);
+    }
+    mc_plan_fini(&plan);
+    return (ferror(out) ? EIO : 0);
+}
+
+/*
+ * With --breakpoints, print one line for each range of display
+ * widths over which the layout of the current category is the same:
+ * the range, the number of columns and rows, and the column widths.
+ */
+
+static int
+mcml_print_breakpoints(mc_opt_t *opt)
+{
+    struct mc_plan *table;
+    size_t ntable;
+    size_t k;
+    size_t col;
+
+    table = mc_breakpoints(mc_nelem, spilling ? NULL : mc_elemv, opt, &ntable);
+    for (k = 0; k < ntable; ++k) {
+        size_t last = k + 1 < ntable ? table[k + 1].llen - 1 : opt->llen;
+
+        fprintf(out, "%zu-%zu: %zu x %zu:", table[k].llen, last,
+            table[k].cols, table[k].rows);
+        for (col = 0; col < table[k].cols; ++col) {
+            fprintf(out, " %zu", table[k].widths[col]);
+        }
+        fputc('\n', out);
+    }
+    mc_breakpoints_free(table, ntable);
+    return (ferror(out) ? EIO : 0);
+}
+
 void
 mc_flush(void)
 {
-    if (mc_nelem == 0) {
-        return;
-    }
+    mc_opt_t opt;
+    int err;
+
+    if (follow) {
+        // The last frame of the category, unless it is already showing
+        if (follow_dirty) {
+            follow_frame();
+        }
+        mc_follow_free(follow_fl);
+        follow_fl = NULL;
+        window_reset();
+        mc_reset();
+        return;
+    }
+    if (grid_mode) {
+        err = mc_grid_end(&grid);
+        if (err != 0 && output_err == 0) {
+            output_err = err;
+        }
+        mc_reset();
+        return;
+    }
+    if (mc_nelem == 0) {
+        return;
+    }
+    if (output_err != 0) {
+        mc_reset();
+        return;
+    }
+
+    mcml_opt(&opt);
+    opt.lengths = mc_lenv;
+    if (spilling) {
+        opt.lengths = (const size_t *) spill_map(&spill_lens);
+        opt.packed = (const char *) spill_map(&spill_bytes);
+    }
+    opt.stable = stable_widths ? &page_widths : NULL;
+    if (watch_file != NULL) {
+        opt.stable = NULL;
+        opt.cache = watch_cache();
+    }
+    if (plan_mode != PLAN_NONE) {
+        err = mcml_print_layout(&opt);
+    }
+    else if (breakpoints) {
+        err = mcml_print_breakpoints(&opt);
+    }
+    else if (nwidths != 0) {
+        err = mcml_print_widths(&opt);
+    }
+    else if (fit_rows != 0) {
+        err = mcml_print_fit(&opt);
+    }
+    else if (fixed_rows != 0) {
+        err = mcml_print_rows(&opt);
+    }
+    else {
+        err = mcml_print(&opt);
+    }
+    if (err != 0 && output_err == 0) {
+        output_err = err;
+    }
+    mc_reset();
+}
+
+/*
+ * Add an element.  With --page-elements, a category is printed
+ * a page at a time, each page as soon as it is full, so output starts
+ * after the first page is read, and no more than a page is held.
+ * In a fixed grid, every element is written at once, and not kept.
+ */
+
+static void
+mcml_element(const char *elem, size_t len, bool lasting)
+{
+    if (grid_mode) {
+        int err = mc_grid_put(&grid, elem, len);
+
+        if (err != 0 && output_err == 0) {
+            output_err = err;
+        }
+        return;
+    }
+    if (follow) {
+        if (window != 0) {
+            window_add(elem, len);
+        }
+        else {
+            mc_add_element(elem, len, lasting);
+        }
+        follow_add(len);
+        return;
+    }
+    mc_add_element(elem, len, lasting);
+    if (page_elements != 0 && mc_nelem >= page_elements) {
+        mc_flush();
+    }
+}
+
+/*
+ * Print what has been collected so far, then the header of
+ * the new category.  Pages of the new category do not line up
+ * with those of the old one.
+ */
+
+static void
+mcml_category(const char *name)
+{
+    mc_flush();
+    mc_widths_fini(&page_widths);
+    ++watch_cat;
+    if (follow) {
+        // Shown at the top of each frame
+        free(follow_category);
+        follow_category = guard_malloc(strlen(name) + 1);
+        strcpy(follow_category, name);
+        follow_dirty = true;
+        return;
+    }
+    if (plan_mode == PLAN_JSON) {
+        // Given in each object, so that every line is JSON
+        free(plan_category);
+        plan_category = guard_malloc(strlen(name) + 1);
+        strcpy(plan_category, name);
+        return;
+    }
+    fprintf(out, "%s:\n", name);
+}
+
+// ################ linereader
+
+/*
+ * Read input a large block at a time, with read(2), and split it
+ * into lines in place, using mc_find_byte(), which uses whatever
+ * vector instructions the CPU has.  Lines are returned without their
+ * newline.  A last line with no newline still counts.
+ */
+
+typedef struct linereader linereader_t;
+
+struct linereader {
+    int    fd;
+    bool   mapped;  // buf is a read-only mapping of the whole file
+    char   *buf;
+    size_t siz;     // Size of buf, not counting room for a nul
+    size_t beg;     // Start of unconsumed data
+    size_t end;     // End of data read so far
+    bool   eof;
+    int    err;
+    bool   tail;    // A regular file that may still grow; see --follow
+    bool   dry;     // The last read found nothing new
+    // If not NULL, called before each read; false means read no more
+    bool   (*before_read)(linereader_t *lr);
+};
+
+#define LINEREADER_BLOCK (64 * 1024)
+
+/*
+ * A regular file is mapped, rather than read, so that its lines can be
+ * used where they lie, and written from the page cache.  If it cannot
+ * be mapped, it is read like anything else.
+ *
+ * If |tail|, a regular file is read, not mapped, and reaching its end
+ * is not the end of input: more may be appended later.
+ *
+ * A file being watched is not mapped either: it may be truncated
+ * while it is being read, which would fault a mapping.
+ */
+
+static void
+linereader_init(linereader_t *lr, int fd, bool tail)
+{
+    struct stat st;
+
+    lr->fd = fd;
+    lr->beg = 0;
+    lr->err = 0;
+    lr->tail = false;
+    lr->dry = false;
+    lr->before_read = NULL;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || watch_file != NULL) {
+        st.st_size = 0;
+    }
+    else if (tail) {
+        lr->tail = true;
+        st.st_size = 0;
+    }
+    if (st.st_size > 0) {
+        void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (addr != MAP_FAILED) {
+            madvise(addr, st.st_size, MADV_SEQUENTIAL);
+            lr->mapped = true;
+            lr->buf = (char *) addr;
+            lr->siz = st.st_size;
+            lr->end = st.st_size;
+            lr->eof = true;
+            return;
+        }
+    }
+
+    lr->mapped = false;
+    lr->siz = LINEREADER_BLOCK;
+    lr->buf = (char *) guard_malloc(lr->siz + 1);
+    lr->end = 0;
+    lr->eof = false;
+}
+
+/*
+ * A mapping outlives the reader; elements may still point into it.
+ */
+
+static void
+linereader_fini(linereader_t *lr)
+{
+    if (lr->mapped) {
+        mapping_retain(lr->buf, lr->siz);
+    }
+    else {
+        free(lr->buf);
+    }
+    lr->buf = NULL;
+}
+
+/*
+ * Make room for at least one more block after the unconsumed data,
+ * by sliding it to the front of the buffer, or by growing the buffer,
+ * if a single line is longer than what is left.
+ */
+
+static void
+linereader_fill(linereader_t *lr)
+{
+    ssize_t rv;
 
-    mc(stdout, mc_nelem, (const char **)mc_elemv, width, indent, horizontal);
-    mc_reset();
-}
+    if (lr->beg != 0) {
+        memmove(lr->buf, lr->buf + lr->beg, lr->end - lr->beg);
+        lr->end -= lr->beg;
+        lr->beg = 0;
+    }
+    if (lr->siz - lr->end < LINEREADER_BLOCK) {
+        lr->siz *= 2;
+        lr->buf = (char *) guard_realloc(lr->buf, lr->siz + 1);
+    }
 
-// ################ linebuf
+    /*
+     * The read may wait for input that is slow to come, as from a log
+     * tail, so first push out everything made from input already read.
+     */
+    if (lr->before_read != NULL && !lr->before_read(lr)) {
+        lr->eof = true;
+        return;
+    }
 
-struct linebuf {
-    FILE   *f;
-    char   *buf;
-    void   *sgl;
-    size_t siz;
-    size_t len;
-    int    err;
-    bool   eof;
-};
+    do {
+        rv = read(lr->fd, lr->buf + lr->end, lr->siz - lr->end);
+    } while (rv < 0 && errno == EINTR);
 
-typedef struct linebuf linebuf_t;
+    if (rv < 0) {
+        lr->err = errno;
+        lr->eof = true;
+    }
+    else if (rv == 0) {
+        lr->dry = true;
+        lr->eof = !lr->tail;
+    }
+    else {
+        lr->dry = false;
+        lr->end += rv;
+    }
+}
 
-extern linebuf_t *linebuf_new(void);
-extern void linebuf_init(linebuf_t *lbuf, FILE *f);
-extern void linebuf_sgl_new(linebuf_t *lbuf);
-extern void linebuf_free(linebuf_t *lbuf);
-extern char *sgl_fgetline(linebuf_t *lbuf, int endl);
+/*
+ * Return the next line, without its newline, and set *|lenp|
+ * to its length, or return NULL at end of input.  The line is not
+ * nul-terminated.  Unless the file is mapped, the line stays valid
+ * only until the next call.
+ */
 
-static void
-fgetline(linebuf_t *lbuf)
+static const char *
+linereader_next(linereader_t *lr, size_t *lenp)
 {
-    char *rbuf;
-
-    // Free up any resources leftover from the last time
-    // this line buffer was used.
-    //
-    // In particlur, free up any segments of a scatter/gather list
-    // and the line buffer.
+    size_t scanned = lr->beg;
 
-    linebuf_free(lbuf);
+    while (true) {
+        const char *data = lr->buf;
+        const char *nl = mc_find_byte(data + scanned, data + lr->end, '\n');
 
-    linebuf_sgl_new(lbuf);
+        if (nl != data + lr->end || (lr->eof && lr->end > lr->beg)) {
+            const char *line = data + lr->beg;
 
-    rbuf = sgl_fgetline(lbuf, '\n');
-    (void)rbuf;
+            *lenp = nl - line;
+            lr->beg += *lenp + (nl != data + lr->end);
+            return (line);
+        }
+        if (lr->eof) {
+            return (NULL);
+        }
+        scanned = lr->end - lr->beg;
+        linereader_fill(lr);
+        scanned += lr->beg;
+    }
 }
 
 /*
@@ -333,44 +1821,148 @@ parse_mcml_command(const char *line, char **rcmd, char **rarg)
     return (0);
 }
 
-int
-mcml_stream(const char *fname, FILE *f)
+/*
+ * Has output already failed, or has the reader at the other end
+ * of stdout gone away?  Nothing is written until a whole category
+ * has been read, so without asking, mcml would read and lay out
+ * all of its input only to be killed by SIGPIPE on the first write.
+ *
+ * A pipe whose read end has been closed polls as POLLERR.
+ */
+
+static bool
+output_closed(void)
 {
-    (void)fname;    // We will use later for error reporting.
+    struct pollfd pfd;
+
+    if (output_err == 0 && out != stdout) {
+        pthread_mutex_lock(&outq.lock);
+        output_err = outq.err;
+        pthread_mutex_unlock(&outq.lock);
+    }
+    if (output_err != 0) {
+        return (true);
+    }
 
-    linebuf_t *lbuf;
+    pfd.fd = STDOUT_FILENO;
+    pfd.events = 0;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLERR)) {
+        output_err = EPIPE;
+        return (true);
+    }
+    return (false);
+}
 
-    lbuf = linebuf_new();
-    linebuf_init(lbuf, f);
-    while (true) {
-        fgetline(lbuf);
-        if (lbuf->eof) {
+/*
+ * How many lines to read between checks on stdout.
+ */
+#define CLOSED_CHECK_LINES 4096
+
+static bool
+grid_before_read(linereader_t *lr)
+{
+    (void) lr;
+    fflush(out);
+    return (true);
+}
+
+/*
+ * While waiting for input, show what has been read so far,
+ * when the next frame is due.  A growing regular file always has
+ * something to read, if only its end, so once it has run dry,
+ * wait --follow-interval before reading it again.
+ */
+
+static bool
+follow_before_read(linereader_t *lr)
+{
+    int ready = 0;
+
+    fflush(out);
+    if (lr->tail) {
+        if (lr->dry) {
+            if (follow_dirty) {
+                follow_frame();
+            }
+            ready = follow_poll(-1, follow_ms);
+        }
+        return (ready >= 0);
+    }
+
+    while (ready == 0) {
+        double left = -1;
+
+        if (follow_dirty) {
+            left = follow_due - now_ms();
+            if (left <= 0) {
+                follow_frame();
+                continue;
+            }
+        }
+        ready = follow_poll(lr->fd, left);
+    }
+    return (ready > 0);
+}
+
+/*
+ * Read and lay out |f|.  If |tail| and --follow, keep reading
+ * a regular file after its end, as it grows.
+ */
+
+int
+mcml_stream(const char *fname, FILE *f, bool tail)
+{
+    linereader_t lr;
+    const char *line;
+    size_t len;
+    size_t pfxlen = cmdpfx ? strlen(cmdpfx) : 0;
+    size_t lnr = 0;
+
+    linereader_init(&lr, fileno(f), follow && tail);
+    if (grid_mode) {
+        lr.before_read = grid_before_read;
+    }
+    else if (follow) {
+        lr.before_read = follow_before_read;
+    }
+    while ((line = linereader_next(&lr, &len)) != NULL) {
+        if (++lnr % CLOSED_CHECK_LINES == 0 && output_closed()) {
             break;
         }
-        if (lbuf->len == 0) {
+        if (len == 0) {
             continue;
         }
 
-        // fprintf(stderr, "line=[%s]\n", lbuf->buf);
-
-        if (cmdpfx != NULL && is_prefix(cmdpfx, lbuf->buf)) {
+        if (cmdpfx != NULL && len >= pfxlen && memcmp(line, cmdpfx, pfxlen) == 0) {
+            char *copy;
             char *cmd;
             char *arg;
-            parse_mcml_command(lbuf->buf, &cmd, &arg);
+
+            // Not in the arena; the flush before a new category frees it
+            copy = (char *) guard_malloc(len + 1);
+            memcpy(copy, line, len);
+            copy[len] = '\0';
+            parse_mcml_command(copy, &cmd, &arg);
 
             // fprintf(stderr, "cmd=[%s]\n", cmd);
             // fprintf(stderr, "arg=[%s]\n", arg);
 
             if (strcmp(cmd, "category") == 0) {
-                mc_flush();
-                fprintf(stdout, "%s:\n", arg);
+                mcml_category(arg);
+                free(copy);
                 continue;
             }
+            free(copy);
         }
-        mc_add_element(lbuf->buf);
+        mcml_element(line, len, lr.mapped);
+    }
+    linereader_fini(&lr);
+    if (lr.err != 0) {
+        fprintf(errprint_fh, "read('%s') failed\n", fname);
+        fprintf(errprint_fh, "  errno=%d\n", lr.err);
+        return (lr.err);
     }
-    linebuf_free(lbuf);
-    free(lbuf);
 
     if (each_file) {
         mc_flush();
@@ -397,8 +1989,12 @@ filev_mcml(void)
             return (err);
         }
 
-        rv = mcml_stream(filev[fnr], f);
+        // Only the last file can grow forever
+        rv = mcml_stream(filev[fnr], f, fnr == filec - 1);
         close_rv = fclose(f);
+        if (output_err != 0) {
+            return (0);
+        }
         if (rv) {
             fprintf(errprint_fh, "mcml_stream('%s') failed.\n", filev[fnr]);
             return (rv);
@@ -431,15 +2027,263 @@ argv_mcml(size_t argc, char **argv)
             // fprintf(stderr, "arg=[%s]\n", arg);
 
             if (strcmp(cmd, "category") == 0) {
-                mc_flush();
-                fprintf(stdout, "%s:\n", arg);
+                mcml_category(arg);
                 continue;
             }
         }
-        mc_add_element(argv[i]);
+        mcml_element(argv[i], strlen(argv[i]), true);
+    }
+
+    mc_flush();
+    return (0);
+}
+
+// ################ watch
+
+/*
+ * With --watch, the file is laid out again, into memory, each time
+ * inotify(7) says it has changed, and the result is compared, row
+ * by row, with what is on the screen.  Only rows that changed are
+ * written, each in its place, with cursor addressing; rows that are
+ * gone are cleared.  A status board over a slow link then costs
+ * a few rows for a few changes, not a screenful.
+ *
+ * The directory is watched, not the file, so that a file replaced
+ * by a rename, as editors and atomic writers do, is still seen.
+ */
+
+struct screen_row {
+    const char *text;
+    size_t len;
+};
+
+struct screen {
+    char   *buf;
+    struct screen_row *rowv;
+    size_t nrows;
+    size_t alloc;
+};
+
+static struct screen shown;     // What is on the screen now
+static bool shown_any = false;
+
+/*
+ * How long the file must be left alone, in milliseconds,
+ * before it is shown again, so that it is not shown half written.
+ */
+#define WATCH_SETTLE_MS 50
+
+/*
+ * Rows of the screen that can be written, keeping the last one for
+ * the cursor.  Without a terminal, there is no limit.
+ */
+
+static size_t
+screen_height(void)
+{
+    struct winsize ws;
+
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 1) {
+        return (ws.ws_row - 1);
+    }
+    return ((size_t) -1);
+}
+
+static void
+screen_split(struct screen *scr, char *buf, size_t size)
+{
+    const char *p = buf;
+    const char *end = buf + size;
+
+    scr->buf = buf;
+    scr->nrows = 0;
+    while (p < end) {
+        const char *nl = mc_find_byte(p, end, '\n');
+
+        if (scr->nrows == scr->alloc) {
+            scr->alloc = scr->alloc ? 2 * scr->alloc : 64;
+            scr->rowv = (struct screen_row *) guard_realloc(scr->rowv,
+                scr->alloc * sizeof (*scr->rowv));
+        }
+        scr->rowv[scr->nrows].text = p;
+        scr->rowv[scr->nrows].len = nl - p;
+        ++scr->nrows;
+        p = nl + (nl != end);
+    }
+}
+
+/*
+ * Bring the screen from |shown| to the rows in |buf|, which is
+ * taken over.
+ */
+
+static int
+screen_update(char *buf, size_t size)
+{
+    struct screen scr = { NULL, NULL, 0, 0 };
+    size_t height = screen_height();
+    size_t i;
+
+    screen_split(&scr, buf, size);
+    if (scr.nrows > height) {
+        scr.nrows = height;
+    }
+
+    if (!shown_any) {
+        fputs("\033[H\033[2J", stdout);
+    }
+    for (i = 0; i < scr.nrows; ++i) {
+        const struct screen_row *row = &scr.rowv[i];
+
+        if (shown_any && i < shown.nrows && row->len == shown.rowv[i].len
+            && memcmp(row->text, shown.rowv[i].text, row->len) == 0) {
+            continue;
+        }
+        fprintf(stdout, "\033[%zu;1H", i + 1);
+        fwrite(row->text, 1, row->len, stdout);
+        fputs("\033[K", stdout);
+    }
+    if (shown_any && shown.nrows > scr.nrows) {
+        fprintf(stdout, "\033[%zu;1H\033[J", scr.nrows + 1);
+    }
+    fprintf(stdout, "\033[%zu;1H", scr.nrows + 1);
+
+    free(shown.buf);
+    free(shown.rowv);
+    shown = scr;
+    shown_any = true;
+
+    if (fflush(stdout) != 0) {
+        return (errno);
+    }
+    return (0);
+}
+
+/*
+ * Lay out the whole file, into memory.
+ * Return NULL if it cannot be read, as while it is being replaced.
+ */
+
+static char *
+watch_render(size_t *sizep)
+{
+    FILE *save = out;
+    FILE *mem;
+    FILE *f;
+    char *buf = NULL;
+    size_t size = 0;
+    int rv;
+
+    f = fopen(watch_file, "r");
+    if (f == NULL) {
+        return (NULL);
+    }
+    mem = open_memstream(&buf, &size);
+    if (mem == NULL) {
+        fclose(f);
+        return (NULL);
     }
 
+    out = mem;
+    watch_cat = 0;
+    rv = mcml_stream(watch_file, f, false);
     mc_flush();
+    out = save;
+    fclose(mem);
+    fclose(f);
+    if (rv != 0) {
+        free(buf);
+        return (NULL);
+    }
+    *sizep = size;
+    return (buf);
+}
+
+/*
+ * Read what inotify has to say.  Was it about the watched file?
+ */
+
+static bool
+watch_drain(int ifd, const char *base)
+{
+    union {
+        struct inotify_event ev;
+        char buf[4096];
+    } u;
+    const char *p;
+    ssize_t len;
+    bool hit = false;
+
+    len = read(ifd, u.buf, sizeof (u.buf));
+    for (p = u.buf; len > 0 && p < u.buf + len; ) {
+        const struct inotify_event *ev = (const struct inotify_event *) p;
+
+        if ((ev->mask & IN_Q_OVERFLOW) || (ev->len != 0 && strcmp(ev->name, base) == 0)) {
+            hit = true;
+        }
+        p += sizeof (*ev) + ev->len;
+    }
+    return (hit);
+}
+
+static int
+watch_mcml(void)
+{
+    char *dir;
+    char *slash;
+    const char *base;
+    int ifd;
+    int ready;
+
+    dir = (char *) guard_malloc(strlen(watch_file) + 2);
+    strcpy(dir, watch_file);
+    slash = strrchr(dir, '/');
+    if (slash == NULL) {
+        strcpy(dir, ".");
+        base = watch_file;
+    }
+    else {
+        base = watch_file + (slash - dir) + 1;
+        slash[slash == dir] = '\0';
+    }
+
+    ifd = inotify_init1(IN_CLOEXEC);
+    if (ifd < 0 || inotify_add_watch(ifd, dir,
+        IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE) < 0) {
+        int err = errno;
+
+        fprintf(errprint_fh, "inotify('%s') failed\n", dir);
+        fprintf(errprint_fh, "  errno=%d\n", err);
+        return (err);
+    }
+    free(dir);
+
+    while (true) {
+        char *buf;
+        size_t size;
+
+        buf = watch_render(&size);
+        if (buf != NULL) {
+            int err = screen_update(buf, size);
+
+            if (err != 0) {
+                output_err = err;
+                break;
+            }
+        }
+
+        // Wait for a change, then for the file to settle
+        do {
+            ready = follow_poll(ifd, -1);
+        } while (ready > 0 && !watch_drain(ifd, base));
+        while (ready > 0 && (ready = follow_poll(ifd, WATCH_SETTLE_MS)) > 0) {
+            watch_drain(ifd, base);
+        }
+        if (ready < 0) {
+            break;
+        }
+    }
+    close(ifd);
     return (0);
 }
 
@@ -454,6 +2298,7 @@ main(int argc, char **argv)
     int rv;
 
     set_eprint_fh();
+    mc_widths_init(&page_widths);
     program_path = *argv;
     program_name = sname(program_path);
     option_index = 0;
@@ -507,6 +2352,159 @@ main(int argc, char **argv)
         case 'w':
             rv = parse_cardinal(&width, optarg);
             break;
+        case 'i':
+            rv = parse_cardinal(&indent, optarg);
+            break;
+        case 'e':
+            rv = mc_engine_lookup(optarg);
+            if (rv < 0) {
+                eprintf("%s: unknown engine, '%s'\n", program_name, optarg);
+                ++err_count;
+            }
+            else {
+                engine = (enum mc_engine) rv;
+            }
+            rv = 0;
+            break;
+        case 't':
+            rv = parse_cardinal(&threads, optarg);
+            break;
+        case 'o':
+            if (strcmp(optarg, "auto") == 0) {
+                output_mode = OUTPUT_AUTO;
+            }
+            else if (strcmp(optarg, "writev") == 0) {
+                output_mode = OUTPUT_WRITEV;
+            }
+            else if (strcmp(optarg, "splice") == 0) {
+                output_mode = OUTPUT_SPLICE;
+            }
+            else if (strcmp(optarg, "stdio") == 0) {
+                output_mode = OUTPUT_STDIO;
+            }
+            else {
+                eprintf("%s: unknown output mode, '%s'\n", program_name, optarg);
+                ++err_count;
+            }
+            break;
+        case 'B':
+            rv = parse_cardinal(&write_buffers, optarg);
+            break;
+        case 'R':
+            rv = parse_cardinal(&max_rows, optarg);
+            break;
+        case 'T':
+            trailer = true;
+            break;
+        case 'P':
+            rv = parse_cardinal(&page_elements, optarg);
+            break;
+        case 'S':
+            stable_widths = true;
+            break;
+        case 'C':
+            rv = parse_cardinal(&columns, optarg);
+            grid_mode = true;
+            break;
+        case 'W':
+            rv = parse_cardinal(&col_width, optarg);
+            grid_mode = true;
+            break;
+        case 'X':
+            uniform = true;
+            break;
+        case 'Q':
+            auto_orientation = false;
+            if (strcmp(optarg, "vertical") == 0) {
+                horizontal = false;
+            }
+            else if (strcmp(optarg, "horizontal") == 0) {
+                horizontal = true;
+            }
+            else if (strcmp(optarg, "auto") == 0) {
+                auto_orientation = true;
+            }
+            else {
+                eprintf("%s: unknown orientation, '%s'\n", program_name, optarg);
+                ++err_count;
+            }
+            break;
+        case 'O':
+            if (strcmp(optarg, "truncate") == 0) {
+                overflow = MC_OVERFLOW_TRUNCATE;
+            }
+            else if (strcmp(optarg, "span") == 0) {
+                overflow = MC_OVERFLOW_SPAN;
+            }
+            else {
+                eprintf("%s: unknown overflow policy, '%s'\n", program_name, optarg);
+                ++err_count;
+            }
+            break;
+        case 'M':
+            rv = parse_size(&memory_budget, optarg);
+            if (rv != 0) {
+                eprintf("%s: bad memory budget, '%s'\n", program_name, optarg);
+                ++err_count;
+            }
+            rv = 0;
+            break;
+        case 'F':
+            follow = true;
+            break;
+        case 'U':
+            watch_file = optarg;
+            break;
+        case 'L':
+            if (optarg == NULL) {
+                plan_mode = PLAN_TEXT;
+            }
+            else if (strcmp(optarg, "json") == 0) {
+                plan_mode = PLAN_JSON;
+            }
+            else {
+                eprintf("%s: unknown plan format, '%s'\n", program_name, optarg);
+                ++err_count;
+            }
+            break;
+        case 'G':
+            rv = parse_cardinal(&fixed_rows, optarg);
+            if (rv != 0 || fixed_rows == 0) {
+                eprintf("%s: bad number of rows, '%s'\n", program_name, optarg);
+                ++err_count;
+            }
+            rv = 0;
+            break;
+        case 'Y':
+            rv = parse_cardinal(&fit_rows, optarg);
+            if (rv != 0 || fit_rows == 0) {
+                eprintf("%s: bad number of rows, '%s'\n", program_name, optarg);
+                ++err_count;
+            }
+            rv = 0;
+            break;
+        case 'K':
+            breakpoints = true;
+            break;
+        case 'D':
+            rv = parse_widths(optarg);
+            if (rv != 0) {
+                eprintf("%s: bad list of widths, '%s'\n", program_name, optarg);
+                ++err_count;
+            }
+            rv = 0;
+            break;
+        case 'N':
+            rv = parse_cardinal(&window, optarg);
+            follow = true;
+            break;
+        case 'I':
+            rv = parse_cardinal(&follow_ms, optarg);
+            if (rv == 0 && follow_ms == 0) {
+                eprintf("%s: --follow-interval must be at least 1\n", program_name);
+                ++err_count;
+            }
+            break;
         case 'c':
             cmdpfx = optarg;
             break;
@@ -555,21 +2553,122 @@ main(int argc, char **argv)
         }
     }
 
+    if (follow && grid_mode) {
+        eprintf("%s: --follow and --window do not go with --columns or --col-width\n",
+            program_name);
+        ++err_count;
+    }
+    if (breakpoints && (nwidths != 0 || follow || grid_mode)) {
+        eprintf("%s: --breakpoints does not go with --widths, --follow, --window, --columns or --col-width\n",
+            program_name);
+        ++err_count;
+    }
+    if (plan_mode != PLAN_NONE && (fixed_rows != 0 || fit_rows != 0 || breakpoints || nwidths != 0 || follow || grid_mode)) {
+        eprintf("%s: --plan does not go with --rows, --max-rows-fit, --breakpoints, --widths, --follow, --window, --columns or --col-width\n",
+            program_name);
+        ++err_count;
+    }
+    if (fixed_rows != 0 && (uniform || auto_orientation || fit_rows != 0 || breakpoints || nwidths != 0 || follow || grid_mode)) {
+        eprintf("%s: --rows does not go with --uniform, --orientation=auto, --max-rows-fit, --breakpoints, --widths, --follow, --window, --columns or --col-width\n",
+            program_name);
+        ++err_count;
+    }
+    if (uniform && (fit_rows != 0 || breakpoints || nwidths != 0 || follow || grid_mode)) {
+        eprintf("%s: --uniform does not go with --max-rows-fit, --breakpoints, --widths, --follow, --window, --columns or --col-width\n",
+            program_name);
+        ++err_count;
+    }
+    if (auto_orientation && (fit_rows != 0 || breakpoints || nwidths != 0 || follow || grid_mode)) {
+        eprintf("%s: --orientation=auto does not go with --max-rows-fit, --breakpoints, --widths, --follow, --window, --columns or --col-width\n",
+            program_name);
+        ++err_count;
+    }
+    if (fit_rows != 0 && (breakpoints || nwidths != 0 || follow || grid_mode)) {
+        eprintf("%s: --max-rows-fit does not go with --breakpoints, --widths, --follow, --window, --columns or --col-width\n",
+            program_name);
+        ++err_count;
+    }
+    if (nwidths != 0 && (follow || grid_mode)) {
+        eprintf("%s: --widths does not go with --follow, --window, --columns or --col-width\n",
+            program_name);
+        ++err_count;
+    }
+    if (watch_file != NULL && (follow || grid_mode || opt_argv || filec != 0)) {
+        eprintf("%s: --watch takes one file, and nothing else to show\n",
+            program_name);
+        ++err_count;
+    }
+
     if (err_count != 0) {
         usage();
         exit(1);
     }
 
+    if (follow) {
+        /*
+         * Every frame shows the whole category, so all of it is kept
+         * in memory, and it is never cut into pages.
+         */
+        page_elements = 0;
+        memory_budget = 0;
+        follow_tty = isatty(STDOUT_FILENO);
+    }
+
     if (width == 0) {
         width = 80;
     }
 
-    if (opt_argv) {
+    /*
+     * --output auto: render through stdio, and let the writer thread
+     * splice into a pipe.  Without a writer thread, splice from libmc.
+     */
+    out = stdout;
+    {
+        struct stat st;
+        bool pipe_out = fstat(STDOUT_FILENO, &st) == 0 && S_ISFIFO(st.st_mode);
+        bool auto_mode = (output_mode == OUTPUT_AUTO);
+
+        if (auto_mode) {
+            output_mode = (pipe_out && write_buffers < 2) ? OUTPUT_SPLICE : OUTPUT_STDIO;
+        }
+        if (grid_mode || follow || watch_file != NULL) {
+            /*
+             * A grid, or a frame, is written as its input is read,
+             * and flushed before each read; a writer thread would only
+             * hold it back.  --watch lays out into memory.
+             */
+            output_mode = OUTPUT_STDIO;
+        }
+        else if (output_mode == OUTPUT_STDIO && write_buffers >= 2) {
+            FILE *f = outq_open(&outq, STDOUT_FILENO, write_buffers, auto_mode && pipe_out);
+
+            if (f != NULL) {
+                out = f;
+            }
+        }
+    }
+
+    if (grid_mode) {
+        mc_opt_t opt;
+
+        mc_opt_init(&opt);
+        opt.llen = width;
+        opt.indent = indent;
+        opt.columns = columns;
+        opt.col_width = col_width;
+        opt.overflow = overflow;
+        mc_grid_init(&grid, out, &opt);
+    }
+
+    if (watch_file != NULL) {
+        rv = watch_mcml();
+    }
+    else if (opt_argv) {
         rv = argv_mcml(filec, filev);
     }
     else if (filec == 0) {
         each_file = true;
-        rv = mcml_stream("-", stdin);
+        rv = mcml_stream("-", stdin, true);
     }
     else {
         rv = filev_probe(filec, filev);
@@ -584,5 +2683,27 @@ main(int argc, char **argv)
         exit(rv);
     }
 
+    if (out != stdout) {
+        fclose(out);
+        if (output_err == 0) {
+            output_err = outq.err;
+        }
+    }
+    if (fflush(stdout) != 0 && output_err == 0) {
+        output_err = errno;
+    }
+    if (output_err == EPIPE) {
+        /*
+         * Die the way a write to the closed pipe would have,
+         * so that the shell does not report an error.
+         */
+        signal(SIGPIPE, SIG_DFL);
+        raise(SIGPIPE);
+    }
+    if (output_err != 0) {
+        eprintf("%s: write failed: %s\n", program_name, strerror(output_err));
+        exit(1);
+    }
+
     exit(0);
 }
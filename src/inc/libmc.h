@@ -0,0 +1,443 @@
+/*
+ * Filename: libmc.h
+ * Library: libmc
+ * Brief: Public interface to libmc, the heart of Multi-Column Markup Language
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIBMC_H
+#define _LIBMC_H
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>      // Import size_t
+
+/*
+ * Layout engines.
+ *
+ * All engines choose exactly the same number of columns and the same
+ * column widths.  They differ only in how much work it takes to get there.
+ *
+ * MC_ENGINE_FULL:
+ *     The algorithm from GNU ls.  Every candidate column count is
+ *     evaluated against every element.  Kept as the reference.
+ *
+ * MC_ENGINE_PRUNE:
+ *     Rule out candidates up front, using a histogram of element lengths,
+ *     and drop candidates from the inner loop as soon as they overflow.
+ *
+ * MC_ENGINE_DESCEND:
+ *     Try one candidate at a time, from the most columns down,
+ *     abandoning each as soon as it overflows, and stop at the first
+ *     that fits.  This is the default.
+ *
+ * MC_ENGINE_SAMPLE:
+ *     Estimate the column count from a random sample of lengths,
+ *     evaluate the estimate and its neighbors exactly in one pass,
+ *     then verify, searching further only if verification fails.
+ *     Meant for huge lists.
+ */
+
+enum mc_engine {
+    MC_ENGINE_DEFAULT,
+    MC_ENGINE_FULL,
+    MC_ENGINE_PRUNE,
+    MC_ENGINE_DESCEND,
+    MC_ENGINE_SAMPLE,
+    MC_ENGINE_COUNT
+};
+
+/*
+ * What to do with an element wider than a column of a fixed grid.
+ *
+ * MC_OVERFLOW_TRUNCATE:
+ *     Cut it to the width of the column.
+ *
+ * MC_OVERFLOW_SPAN:
+ *     Write it in full, across as many columns as it needs,
+ *     starting a new row if they are not left in the current one.
+ */
+
+enum mc_overflow {
+    MC_OVERFLOW_TRUNCATE,
+    MC_OVERFLOW_SPAN,
+};
+
+/*
+ * Column widths of a layout, kept by the caller.  See mc_opt.stable.
+ * Initialize with mc_widths_init(); release with mc_widths_fini().
+ */
+
+struct mc_widths {
+    size_t cols;        /* 0: nothing kept yet */
+    size_t *widths;     /* Including the white space after the column */
+    size_t alloc;
+};
+
+/*
+ * The element lengths and the layout of a list, kept by the caller.
+ * See mc_opt.cache.
+ * Initialize with mc_cache_init(); release with mc_cache_fini().
+ */
+
+struct mc_cache {
+    size_t nelem;       /* 0: nothing kept yet */
+    size_t *lengths;    /* Of each element of the list laid out */
+    size_t alloc;
+    bool by_columns;
+    struct mc_widths widths;
+};
+
+/*
+ * Options that control layout and printing.
+ * Always initialize with mc_opt_init(), then override fields.
+ *
+ * llen:
+ *     Line length (display width).
+ *
+ * indent:
+ *     Indentation of each line.  Number of spaces.
+ *
+ * horizontal:
+ *     Arrange elements across rows, rather than down columns.
+ *
+ * engine:
+ *     Which layout engine to use.
+ *
+ * cell_bits:
+ *     Minimum width, in bits, of the integers used to hold lengths
+ *     during layout: 0 (automatic), 16, 32 or 64.  libmc uses the
+ *     narrowest width that is safe for the display width;
+ *     this only makes it use a wider one.  Mostly for testing.
+ *
+ * threads:
+ *     Number of threads used to render rows, once the layout is known,
+ *     including the calling thread.  0 means one per online CPU.
+ *     The default is 1.  Small lists are always rendered by one thread.
+ *     Output is the same, whatever the number of threads.
+ *
+ * lengths:
+ *     If not NULL, lengths[i] is the length of elemv[i], which then
+ *     need not be nul-terminated.  Lets elements point straight into
+ *     a buffer or a file mapping.  Default NULL.
+ *
+ * splice:
+ *     mc_write() only.  If the file descriptor is a pipe, render rows
+ *     into fresh page-aligned buffers and give the pages to the pipe
+ *     with vmsplice(2), rather than copying them in.  Falls back to
+ *     write(2) if vmsplice() is refused.  Default false.
+ *
+ * max_rows:
+ *     Print at most this many rows.  0 (the default) means no limit.
+ *     Column widths are still those of the whole list, so the rows
+ *     shown are exactly the first rows of the full output.
+ *
+ * trailer:
+ *     If max_rows left some elements out, end with an indented line
+ *     "... N more", where N is the number of elements not shown.
+ *     Default false.
+ *
+ * stable:
+ *     If not NULL, column widths kept from one call to the next, so that
+ *     a list printed in pages can keep its columns lined up.  The widths
+ *     kept from the previous call are used again, with the same number
+ *     of columns, as long as every element still fits them; otherwise
+ *     the list is laid out afresh, and its widths are kept instead.
+ *     The widths depend on the orientation, the display width and the
+ *     indentation, so keep one mc_widths for each combination.
+ *     Default NULL.
+ *
+ * cache:
+ *     If not NULL, the element lengths and the layout of the previous
+ *     call.  A list of as many elements, of the same lengths, has
+ *     the same layout, so it is used again, with no layout pass;
+ *     any other list is laid out afresh, and kept instead.  Unlike
+ *     stable, the output is always what it would be with nothing kept.
+ *     The layout depends on the display width, the indentation and
+ *     the options that choose the orientation and the columns, so keep
+ *     one mc_cache for each combination.  Not used with stable.
+ *     Default NULL.
+ *
+ * columns, col_width, overflow:
+ *     mc_grid only.  The number of columns of a fixed grid, the width
+ *     of each, not counting the two spaces between columns, and what
+ *     to do with elements wider than that.  If only one of columns and
+ *     col_width is given, the other is derived from llen and indent.
+ *     Defaults 0, 0 and MC_OVERFLOW_TRUNCATE.
+ *
+ * packed:
+ *     If not NULL, the elements are stored back to back, in order,
+ *     with nothing between them, starting at packed, and elemv is not
+ *     used; it may be NULL.  lengths must then be given.  For lists
+ *     too big to keep an array of pointers to, such as a list spilled
+ *     to a file and mapped back in.  Default NULL.
+ *
+ * window:
+ *     mc_follow only.  If not 0, lay out only the last window elements
+ *     appended, as in a rolling view of a log.  Default 0.
+ *
+ * auto_orientation:
+ *     mc_print, mc_write and mc_columns only.  Lay out both down
+ *     columns and across rows, in a single pass, and use whichever
+ *     takes fewer rows; on a tie, whichever has the narrower lines,
+ *     and then down columns.  horizontal is not used.  Kept widths
+ *     (stable) are only tried in the orientation chosen.
+ *     Default false.
+ *
+ * uniform:
+ *     mc_print, mc_write and mc_columns only.  Make all columns the
+ *     same width, that of the longest element, and fit as many as the
+ *     line allows, as with tab stops.  Needs only the longest length,
+ *     so it takes no layout search; for huge lists.  With uniform,
+ *     auto_orientation is not used.  Default false.
+ */
+
+struct mc_opt {
+    size_t llen;
+    size_t indent;
+    bool horizontal;
+    enum mc_engine engine;
+    unsigned int cell_bits;
+    unsigned int threads;
+    const size_t *lengths;
+    bool splice;
+    size_t max_rows;
+    bool trailer;
+    struct mc_widths *stable;
+    struct mc_cache *cache;
+    size_t columns;
+    size_t col_width;
+    enum mc_overflow overflow;
+    const char *packed;
+    size_t window;
+    bool auto_orientation;
+    bool uniform;
+};
+
+typedef struct mc_opt mc_opt_t;
+
+/*
+ * The geometry of a layout, without the layout itself.
+ *
+ * llen:
+ *     Display width the plan is for.
+ *
+ * cols, rows:
+ *     Number of columns and rows.  Both 0 for an empty list.
+ *
+ * widths:
+ *     Width of each of the cols columns, as in struct mc_widths:
+ *     including the two spaces after each column but the last.
+ *     Release with mc_plan_fini().
+ *
+ * horizontal:
+ *     Elements go across rows, rather than down columns.  As in the
+ *     options, except where mc_plan() chose it (auto_orientation).
+ */
+
+struct mc_plan {
+    size_t llen;
+    size_t cols;
+    size_t rows;
+    size_t *widths;
+    bool horizontal;
+};
+
+/*
+ * A fixed grid, written to as elements arrive, across rows.
+ * Elements are written at once and nothing is kept, so it works
+ * on lists of any length, including ones that never end.
+ *
+ * mc_grid_init:
+ *     Start a grid on |f|, with the geometry given in |opt|.
+ *
+ * mc_grid_put:
+ *     Write one element of |len| bytes, which need not be
+ *     nul-terminated.
+ *
+ * mc_grid_end:
+ *     Finish the current row, if any.  Call before writing anything
+ *     else to |f|, and at the end.
+ *
+ * mc_grid_put() and mc_grid_end() return 0, or the errno value of
+ * the first write that failed; after that, nothing more is written.
+ */
+
+struct mc_grid {
+    FILE *f;
+    size_t cols;
+    size_t width;
+    size_t indent;
+    enum mc_overflow overflow;
+    size_t col;         /* Next column of the current row; 0: none started */
+    size_t pad;         /* Spaces owed before the next element in this row */
+    int err;
+};
+
+typedef struct mc_grid mc_grid_t;
+
+extern void   mc_opt_init(mc_opt_t *opt);
+extern void   mc_widths_init(struct mc_widths *stable);
+extern void   mc_widths_fini(struct mc_widths *stable);
+extern void   mc_cache_init(struct mc_cache *cache);
+extern void   mc_cache_fini(struct mc_cache *cache);
+extern int    mc_print(FILE *f, size_t nelem, const char **elemv, const mc_opt_t *opt);
+extern size_t mc_columns(size_t nelem, const char **elemv, const mc_opt_t *opt);
+extern int    mc_write(int fd, size_t nelem, const char **elemv, const mc_opt_t *opt);
+extern int    mc(FILE *f, size_t nelem, const char **elemv, size_t llen, size_t indent, bool horizontal);
+
+/*
+ * mc_plan:
+ *     The layout mc_print() would use, without printing: the number
+ *     of columns and rows, the width of each column and the
+ *     orientation, for callers that draw the list themselves.
+ *
+ * mc_plans:
+ *     Lay out the same list at several display widths at once, sharing
+ *     the work between them, much as if mc_columns() had been called
+ *     for each width, but for about the cost of one call.  Set llen in
+ *     each of the |nplans| plans; the other fields are filled in.
+ */
+
+extern void   mc_plan(size_t nelem, const char **elemv, const mc_opt_t *opt, struct mc_plan *plan);
+extern void   mc_plans(size_t nelem, const char **elemv, const mc_opt_t *opt, size_t nplans, struct mc_plan *plans);
+extern void   mc_plan_fini(struct mc_plan *plan);
+
+/*
+ * mc_breakpoints:
+ *     The layout of a list at every display width from 1 to opt->llen,
+ *     as a table of the widths at which it changes.  Entry k has the
+ *     layout for widths from table[k].llen up to, but not including,
+ *     table[k + 1].llen, or up to opt->llen for the last entry.
+ *     Entries are in increasing order of llen, and of columns.
+ *     Only widths greater than opt->indent are meaningful.
+ *     Costs about as much as laying out at opt->llen.
+ *
+ * mc_breakpoint_find:
+ *     The entry for display width |llen|, by binary search.
+ *
+ * mc_breakpoints_free:
+ *     Release a table.
+ */
+
+extern struct mc_plan *mc_breakpoints(size_t nelem, const char **elemv, const mc_opt_t *opt, size_t *nplans);
+extern const struct mc_plan *mc_breakpoint_find(const struct mc_plan *table, size_t nplans, size_t llen);
+extern void   mc_breakpoints_free(struct mc_plan *table, size_t nplans);
+
+/*
+ * mc_fit_rows:
+ *     The narrowest display width, up to opt->llen, at which a list
+ *     is laid out in at most |max_rows| rows, as for a box of fixed
+ *     height.  Fill in |plan| with that width, in llen, and the layout
+ *     at that width.  Return 0, or ERANGE if no width up to opt->llen
+ *     will do.  Release |plan| with mc_plan_fini().
+ */
+
+extern int    mc_fit_rows(size_t nelem, const char **elemv, const mc_opt_t *opt, size_t max_rows, struct mc_plan *plan);
+
+/*
+ * mc_plan_rows:
+ *     Lay out a list in at most |rows| rows, as for a panel of fixed
+ *     height, with the fewest columns that allows: ceil(nelem / rows).
+ *     The display width does not limit it.  Fill in |plan|; its llen
+ *     is the width the layout takes: the indentation plus the widths
+ *     of all columns.  Return 0, or EINVAL if |rows| is 0.
+ *     Release |plan| with mc_plan_fini().
+ */
+
+extern int    mc_plan_rows(size_t nelem, const char **elemv, const mc_opt_t *opt, size_t rows, struct mc_plan *plan);
+
+extern void   mc_grid_init(mc_grid_t *grid, FILE *f, const mc_opt_t *opt);
+extern int    mc_grid_put(mc_grid_t *grid, const char *elem, size_t len);
+extern int    mc_grid_end(mc_grid_t *grid);
+
+/*
+ * Follow a list that grows, one element at a time, and know its best
+ * layout at any time, without laying out the whole list again.
+ * The layout is the same as the one mc_print() would choose.
+ *
+ * mc_follow_new:
+ *     Start following an empty list, to be laid out with |opt|.
+ *
+ * mc_follow_add:
+ *     Append an element of length |len|.  With a window, once it is
+ *     full, the oldest element leaves it.
+ *
+ * mc_follow_columns:
+ *     Number of columns of the best layout so far.
+ *
+ * mc_follow_print:
+ *     Print the elements so far, or in the window, |elemv|,
+ *     with that layout.
+ *     |opt| must be the same as for mc_follow_new().
+ *
+ * mc_follow_free:
+ *     Stop following.
+ */
+
+typedef struct mc_follow mc_follow_t;
+
+extern mc_follow_t *mc_follow_new(const mc_opt_t *opt);
+extern void   mc_follow_add(mc_follow_t *fl, size_t len);
+extern size_t mc_follow_columns(const mc_follow_t *fl);
+extern int    mc_follow_print(mc_follow_t *fl, FILE *f, size_t nelem, const char **elemv, const mc_opt_t *opt);
+extern void   mc_follow_free(mc_follow_t *fl);
+
+extern const char *mc_engine_name(enum mc_engine engine);
+extern int    mc_engine_lookup(const char *name);
+
+/*
+ * libmc picks the fastest vectorized kernels the CPU supports, at run time.
+ * The environment variable MC_SIMD (generic, sse2, avx2, avx512)
+ * can force a particular variant, if the CPU supports it.
+ *
+ * mc_simd_variant:
+ *     Name of the variant in use.
+ *
+ * mc_find_byte:
+ *     Address of the first byte equal to |c| in [p, end),
+ *     or |end| if there is none.  For readers splitting input into lines.
+ */
+
+extern const char *mc_simd_variant(void);
+extern const char *mc_find_byte(const char *p, const char *end, int c);
+
+/*
+ * mc_splice_out:
+ *     Write the |len| bytes at |p| to the pipe |fd|, handing its pages
+ *     to the pipe with vmsplice(2) and SPLICE_F_GIFT, or with plain
+ *     write(2) once *use_write is set.  If vmsplice() is refused, it
+ *     sets *use_write and goes on with write().  If |spliced| is not
+ *     NULL, it is set if any byte was spliced: the pipe may then still
+ *     refer to those pages, which must never be written again.
+ *     Return 0, or the errno value of the write that failed.
+ *     This is how mc_write() splices; for callers with pages of
+ *     their own to give.
+ */
+
+extern int    mc_splice_out(int fd, const char *p, size_t len, bool *use_write, bool *spliced);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif  /* _LIBMC_H */
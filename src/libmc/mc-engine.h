@@ -0,0 +1,1098 @@
+/*
+ * Filename: src/libmc/mc-engine.h
+ * Project: libmc
+ * Brief: Layout engines, instantiated once for each cell width
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This file is a template.  It has no include guard, on purpose.
+ * mc.c includes it once for each width of integer used to store
+ * element lengths and column_info cells, with
+ *
+ *     CELL_T     the integer type, for example uint16_t, and
+ *     CELL_BITS  its width in bits, which is also the suffix
+ *                given to every function and type defined here.
+ *
+ * Lengths are stored clamped to mc->len_cap, and cells never get
+ * much larger than the display width, so for all practical display
+ * widths 16 or 32 bits are plenty.  See choose_cell_bits() in mc.c.
+ *
+ * Code that does not depend on the cell width lives in mc.c.
+ */
+
+#define T_(name) MC_CAT(name, CELL_BITS)
+
+/* Information about filling a column.  */
+
+struct T_(column_info) {
+    CELL_T line_len;
+    CELL_T *col_arr;
+};
+
+#define COLUMN_INFO(mc) ((struct T_(column_info) *) (mc)->column_info)
+#define LENV(mc) ((CELL_T *) (mc)->lenv)
+
+/*
+ * Allocate enough column info suitable for the current number of
+ * elements and display columns, and initialize the info to represent the
+ * narrowest possible columns.
+ */
+
+static void
+T_(init_column_info)(mc_t *mc)
+{
+  struct T_(column_info) *column_info;
+  size_t i;
+  size_t max_cols;
+
+  max_cols = MIN(mc->max_idx, mc->nelem);
+  column_info = COLUMN_INFO(mc);
+  if (mc->column_info_alloc < max_cols) {
+      size_t new_column_info_alloc;
+      CELL_T *p;
+
+      if (max_cols < mc->max_idx / 2) {
+          /*
+           * The number of columns is far less than the display width allows.
+           * Grow the allocation, but only so that it's double the current
+           * requirements.  If the display is extremely wide, this avoids
+           * allocating a lot of memory that is never needed.
+           */
+          column_info = (struct T_(column_info) *) xnrealloc(column_info, max_cols, 2 * sizeof (*column_info));
+          new_column_info_alloc = 2 * max_cols;
+        }
+      else {
+          column_info = (struct T_(column_info) *) xnrealloc (column_info, mc->max_idx, sizeof (*column_info));
+          new_column_info_alloc = mc->max_idx;
+        }
+
+      /*
+       * Allocate the new cells by computing the triangle
+       * formula n * (n + 1) / 2, except that we don't need to
+       * allocate the part of the triangle that we've already
+       * allocated.  Check for address arithmetic overflow.
+       */
+
+      {
+        size_t column_info_growth = new_column_info_alloc - mc->column_info_alloc;
+        size_t s = mc->column_info_alloc + 1 + new_column_info_alloc;
+        size_t t = s * column_info_growth;
+        if (s < new_column_info_alloc || t / column_info_growth != s)
+          xalloc_die ();
+        p = (CELL_T *) xnmalloc(t / 2, sizeof (*p));
+      }
+
+      /* Grow the triangle by parceling out the cells just allocated.  */
+      for (i = mc->column_info_alloc; i < new_column_info_alloc; ++i) {
+          column_info[i].col_arr = p;
+          p += i + 1;
+        }
+
+      mc->column_info = column_info;
+      mc->column_info_alloc = new_column_info_alloc;
+    }
+
+  init_valid(mc, max_cols);
+  for (i = 0; i < max_cols; ++i) {
+      size_t j;
+
+      column_info[i].line_len = (i + 1) * MIN_COLUMN_WIDTH;
+      for (j = 0; j <= i; ++j) {
+        column_info[i].col_arr[j] = MIN_COLUMN_WIDTH;
+      }
+    }
+}
+
+static void
+T_(fini_column_info)(mc_t *mc)
+{
+    if (mc->column_info_alloc != 0) {
+        free(COLUMN_INFO(mc)[0].col_arr);
+    }
+}
+
+/*
+ * Measure every element once, so that neither the layout engines
+ * nor the printers need to call strlen() again.
+ */
+
+static void
+T_(measure_elements)(mc_t *mc)
+{
+    CELL_T *lenv;
+    size_t enr;
+
+    lenv = (CELL_T *) xnmalloc(MAX(mc->nelem, 1), sizeof (*lenv));
+    if (lenv == NULL) {
+        xalloc_die();
+    }
+
+    mc->max_len = 0;
+    for (enr = 0; enr < mc->nelem; ++enr) {
+        size_t len;
+
+        if (mc->lengths != NULL) {
+            len = mc->lengths[enr];
+        }
+        else {
+            len = mc_simd->strlen(mc->elemv[enr]);
+        }
+        lenv[enr] = MIN(len, mc->len_cap);
+        mc->max_len = MAX(mc->max_len, len);
+    }
+    mc->lenv = lenv;
+}
+
+/*
+ * The reference engine, straight from GNU ls.
+ * Every candidate is visited for every element;
+ * candidates that have overflowed are skipped.
+ */
+
+static void
+T_(scan_full)(mc_t *mc, bool by_columns, size_t max_cols)
+{
+    struct T_(column_info) *column_info = COLUMN_INFO(mc);
+    size_t enr;      /* Index into elements.  */
+
+    /* Compute the maximum number of possible columns.  */
+    for (enr = 0; enr < mc->nelem; ++enr) {
+        size_t elem_length = LENV(mc)[enr];
+        size_t i;
+
+        for (i = 0; i < max_cols; ++i) {
+            if (valid_test(mc, i)) {
+                size_t idx = (by_columns
+                ? enr / ((mc->nelem + i) / (i + 1))
+                : enr % (i + 1));
+                size_t real_length = elem_length + (idx == i ? 0 : 2);
+
+                if (column_info[i].col_arr[idx] < real_length) {
+                    column_info[i].line_len += (real_length
+                    - column_info[i].col_arr[idx]);
+                    column_info[i].col_arr[idx] = real_length;
+                    if (!(column_info[i].line_len < mc->llen - mc->indent)) {
+                        valid_clear(mc, i);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Mark as invalid, before looking at any element in detail,
+ * every candidate that cannot possibly fit.
+ * See line_len_lower_bound() in mc.c.
+ *
+ * A candidate is ruled out only if its lower bound shows that
+ * it must grow past its initial width (otherwise GNU ls would
+ * never have invalidated it) and that it must reach |limit|.
+ *
+ * Return the number of candidates that survive.
+ */
+
+static size_t
+T_(prune_candidates)(mc_t *mc, size_t max_cols, size_t limit)
+{
+    size_t survivors;
+    size_t *hist;
+    size_t cap;
+    size_t enr;
+    size_t i;
+
+    cap = MIN(mc->max_len, limit);
+    hist = (size_t *) calloc(cap + 1, sizeof (*hist));
+    if (hist == NULL) {
+        xalloc_die();
+    }
+
+    for (enr = 0; enr < mc->nelem; ++enr) {
+        ++hist[MIN(LENV(mc)[enr], cap)];
+    }
+
+    /*
+     * The lower bound grows with the number of columns,
+     * so once one candidate is ruled out, so are all wider ones.
+     */
+    for (i = 0; i < max_cols; ++i) {
+        size_t cols = i + 1;
+        size_t lb = line_len_lower_bound(mc, hist, cap, cols, limit);
+
+        if (lb >= limit && lb > cols * MIN_COLUMN_WIDTH) {
+            break;
+        }
+    }
+
+    survivors = i;
+    for (; i < max_cols; ++i) {
+        valid_clear(mc, i);
+    }
+
+    free(hist);
+    return (survivors);
+}
+
+/*
+ * The state of a candidate during a scan is kept in a struct cand,
+ * so that a list of live candidates is compact, and each candidate
+ * carries its counters with it.  See the layout kernels in mc.c.
+ */
+
+struct T_(cand) {
+    struct T_(column_info) *ci;
+    size_t last;    /* Index of the last column */
+    size_t rows;    /* Elements per column, when laid out vertically */
+    size_t row;     /* Counter of elements in the current column */
+    size_t idx;     /* Current column */
+};
+
+static void
+T_(cand_init)(struct T_(cand) *cd, mc_t *mc, size_t i)
+{
+    cd->ci = &COLUMN_INFO(mc)[i];
+    cd->last = i;
+    cd->rows = (mc->nelem + i) / (i + 1);
+    cd->row = 0;
+    cd->idx = 0;
+}
+
+/*
+ * Account for one element of length |len| in the current column
+ * of candidate |cd|.  Return true if the candidate overflows.
+ * cand_grow() leaves the valid bits alone; cand_add() clears
+ * the candidate's bit when it overflows.
+ */
+
+static inline bool
+T_(cand_grow)(struct T_(cand) *cd, size_t len, size_t limit)
+{
+    struct T_(column_info) *ci = cd->ci;
+    size_t real_length = len + (cd->idx == cd->last ? 0 : 2);
+
+    if (ci->col_arr[cd->idx] < real_length) {
+        ci->line_len += real_length - ci->col_arr[cd->idx];
+        ci->col_arr[cd->idx] = real_length;
+        return (ci->line_len >= limit);
+    }
+    return (false);
+}
+
+static inline bool
+T_(cand_add)(mc_t *mc, struct T_(cand) *cd, size_t len, size_t limit)
+{
+    if (T_(cand_grow)(cd, len, limit)) {
+        valid_clear(mc, cd->last);
+        return (true);
+    }
+    return (false);
+}
+
+DEFINE_LAYOUT_KERNELS(vertical, NEXT_VERTICAL)
+DEFINE_LAYOUT_KERNELS(horizontal, NEXT_HORIZONTAL)
+
+static void
+T_(scan_live)(mc_t *mc, bool by_columns, size_t nlive, size_t limit)
+{
+    if (by_columns) {
+        T_(scan_live_vertical)(mc, nlive, limit);
+    }
+    else {
+        T_(scan_live_horizontal)(mc, nlive, limit);
+    }
+}
+
+/*
+ * Vertical layout, one column at a time.
+ *
+ * Laid out vertically, each column is a contiguous run of |rows|
+ * lengths, so its width is a range maximum, which the vectorized
+ * kernels compute many lengths at a time.  Widths are only ever
+ * raised, and line_len only ever grows, so checking for overflow
+ * after each column gives the same answer as checking after each
+ * element.
+ */
+
+static bool
+T_(try_columns_ranges)(mc_t *mc, size_t i, size_t limit)
+{
+    struct T_(column_info) *ci = &COLUMN_INFO(mc)[i];
+    const CELL_T *lenv = LENV(mc);
+    size_t rows = (mc->nelem + i) / (i + 1);
+    size_t start;
+    size_t col;
+
+    for (col = 0, start = 0; col <= i && start < mc->nelem; ++col, start += rows) {
+        size_t n = MIN(rows, mc->nelem - start);
+        size_t real_length = T_(simd_max)(lenv + start, n) + (col == i ? 0 : 2);
+
+        if (ci->col_arr[col] < real_length) {
+            ci->line_len += real_length - ci->col_arr[col];
+            ci->col_arr[col] = real_length;
+            if (ci->line_len >= limit) {
+                valid_clear(mc, i);
+                return (false);
+            }
+        }
+    }
+    return (true);
+}
+
+/*
+ * Horizontal layout, one element at a time.
+ */
+
+static bool
+T_(try_columns_horizontal)(mc_t *mc, size_t i, size_t limit)
+{
+    const CELL_T *lenv = LENV(mc);
+    struct T_(cand) cd;
+    size_t enr;
+
+    T_(cand_init)(&cd, mc, i);
+    for (enr = 0; enr < mc->nelem; ++enr) {
+        if (T_(cand_add)(mc, &cd, lenv[enr], limit)) {
+            return (false);
+        }
+        NEXT_HORIZONTAL(&cd);
+    }
+    return (true);
+}
+
+/*
+ * Evaluate the single candidate, column_info[i].
+ * Give up as soon as it overflows.  Validity follows the same rule
+ * as in scan_full(): a candidate that never has to grow past its
+ * initial width is valid.
+ */
+
+static bool
+T_(try_columns)(mc_t *mc, bool by_columns, size_t i, size_t limit)
+{
+    if (by_columns) {
+        return (T_(try_columns_ranges)(mc, i, limit));
+    }
+    return (T_(try_columns_horizontal)(mc, i, limit));
+}
+
+/*
+ * Evaluate the candidates lo .. hi (numbers of columns, not indices),
+ * at most SAMPLE_WINDOW of them, in a single pass over the lengths.
+ */
+
+static void
+T_(scan_window)(mc_t *mc, bool by_columns, size_t lo, size_t hi, size_t limit)
+{
+    struct T_(cand) win[SAMPLE_WINDOW];
+    size_t nw;
+
+    for (nw = 0; lo + nw <= hi; ++nw) {
+        T_(cand_init)(&win[nw], mc, lo + nw - 1);
+    }
+
+    if (by_columns) {
+        T_(scan_window_vertical)(mc, win, nw, limit);
+    }
+    else {
+        T_(scan_window_horizontal)(mc, win, nw, limit);
+    }
+}
+
+/*
+ * Same result as scan_full(), but candidates that are ruled out,
+ * either up front or by overflowing during the scan, drop out
+ * of the list of live candidates.
+ */
+
+static void
+T_(scan_prune)(mc_t *mc, bool by_columns, size_t max_cols)
+{
+    struct T_(cand) *live;
+    size_t limit = mc->llen - mc->indent;
+    size_t nlive;
+    size_t i;
+
+    T_(prune_candidates)(mc, max_cols, limit);
+
+    live = (struct T_(cand) *) xnmalloc(max_cols, sizeof (*live));
+    if (live == NULL) {
+        xalloc_die();
+    }
+
+    nlive = 0;
+    for (i = 0; i < max_cols; ++i) {
+        if (valid_test(mc, i)) {
+            T_(cand_init)(&live[nlive++], mc, i);
+        }
+    }
+
+    mc->live = live;
+    T_(scan_live)(mc, by_columns, nlive, limit);
+
+    free(mc->live);
+    mc->live = NULL;
+}
+
+/*
+ * Try candidates one at a time, from the most columns down,
+ * and stop at the first one that fits.
+ *
+ * Candidates ruled out by the length bounds are never tried,
+ * so the search starts near the widest feasible column count.
+ * Candidates that do not fit usually overflow after only a few
+ * elements, so most elements are looked at only a few times.
+ *
+ * One column is what calculate_columns() falls back to anyway,
+ * so it is never tried.  Candidates narrower than the one that fits
+ * are never tried either; they cannot be the widest valid candidate.
+ */
+
+static void
+T_(scan_descend)(mc_t *mc, bool by_columns, size_t max_cols)
+{
+    size_t limit = mc->llen - mc->indent;
+    size_t i;
+
+    i = T_(prune_candidates)(mc, max_cols, limit);
+    while (i > 1) {
+        --i;
+        if (T_(try_columns)(mc, by_columns, i, limit)) {
+            return;
+        }
+    }
+}
+
+/*
+ * Estimate the number of columns, from a random sample of element
+ * lengths, plus the exact length of the longest element.
+ *
+ * With |rows| elements per column, the longest element in a column
+ * is about the (1 - 1 / rows) quantile of all lengths.  Once columns
+ * are much longer than the sample, that is as good as the global
+ * maximum, which is what really matters for huge lists.
+ *
+ * The sample is drawn with a fixed seed, so the estimate,
+ * and therefore the work done, is reproducible.
+ */
+
+static size_t
+T_(estimate_columns)(mc_t *mc, size_t max_cols, size_t limit)
+{
+    size_t sample[SAMPLE_SIZE];
+    size_t nsample = MIN(mc->nelem, SAMPLE_SIZE);
+    unsigned long long seed = 0x9e3779b97f4a7c15ULL;
+    size_t cols;
+    size_t k;
+
+    /* Draw the sample, and sort it in decreasing order of length.  */
+    for (k = 0; k < nsample; ++k) {
+        size_t enr;
+
+        if (nsample == mc->nelem) {
+            enr = k;
+        }
+        else {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            enr = seed % mc->nelem;
+        }
+        sample[k] = LENV(mc)[enr];
+    }
+    qsort(sample, nsample, sizeof (*sample), cmp_len_decreasing);
+
+    for (cols = max_cols; cols > 1; --cols) {
+        size_t rows = (mc->nelem + cols - 1) / cols;
+        size_t rank = nsample / rows;
+        size_t col_len = (rank == 0) ? mc->max_len : sample[rank - 1];
+
+        if (cols * (MAX(col_len + 2, MIN_COLUMN_WIDTH)) - 2 < limit) {
+            break;
+        }
+    }
+
+    return (cols);
+}
+
+/*
+ * Find the widest candidate that fits, starting from an estimate,
+ * rather than from the widest possible candidate.
+ *
+ * The estimate and its wider neighbor are evaluated exactly, in a single
+ * pass over the lengths, by scan_window().  Then the result is verified:
+ * every wider candidate must be shown not to fit, and, if neither of
+ * the two fit, narrower candidates are searched.  Candidates outside
+ * the window are ruled out by the global maximum when possible, and
+ * otherwise tried, one at a time, as in scan_descend().  So the result
+ * is always exact; only the amount of work depends on the quality
+ * of the estimate.
+ */
+
+static void
+T_(scan_sample)(mc_t *mc, bool by_columns, size_t max_cols)
+{
+    size_t limit = mc->llen - mc->indent;
+    size_t min_width = MAX(mc->max_len + 2, MIN_COLUMN_WIDTH);
+    size_t est;
+    size_t lo;
+    size_t hi;
+    size_t i;
+
+    est = T_(estimate_columns)(mc, max_cols, limit);
+    lo = MAX(est, 2);
+    hi = MIN(lo + SAMPLE_WINDOW - 1, max_cols);
+    if (lo <= hi) {
+        T_(scan_window)(mc, by_columns, lo, hi, limit);
+    }
+
+    /*
+     * Verify that no wider candidate fits.  The column holding the
+     * longest element is at least |min_width| wide, all others
+     * at least MIN_COLUMN_WIDTH.
+     */
+    for (i = max_cols; i > hi; --i) {
+        size_t lb = min_width + (i - 1) * MIN_COLUMN_WIDTH - 2;
+
+        if (lb >= limit && lb > i * MIN_COLUMN_WIDTH) {
+            valid_clear(mc, i - 1);
+        }
+        else if (T_(try_columns)(mc, by_columns, i - 1, limit)) {
+            return;
+        }
+    }
+
+    for (i = hi; i >= lo; --i) {
+        if (valid_test(mc, i - 1)) {
+            return;
+        }
+    }
+
+    /* Nothing in the window fits.  Search narrower candidates.  */
+    for (i = lo - 1; i > 1; --i) {
+        if (T_(try_columns)(mc, by_columns, i - 1, limit)) {
+            return;
+        }
+    }
+}
+
+/*
+ * Calculate the number of columns needed to represent
+ * the current set of elements in the current display width.
+ * Leave the width of each of those columns in mc->widths.
+ */
+
+static size_t
+T_(calculate_columns)(mc_t *mc, bool by_columns)
+{
+    struct T_(column_info) *line_fmt;
+    size_t cols;     /* Number of elements across.  */
+    size_t col;
+
+    /*
+     * Normally the maximum number of columns is determined by the screen width.
+     * But if few files are available this might limit it as well.
+     */
+    size_t max_cols = MIN(mc->max_idx, mc->nelem);
+
+    T_(init_column_info)(mc);
+
+    switch (mc->engine) {
+    case MC_ENGINE_FULL:
+        T_(scan_full)(mc, by_columns, max_cols);
+        break;
+    case MC_ENGINE_PRUNE:
+        T_(scan_prune)(mc, by_columns, max_cols);
+        break;
+    case MC_ENGINE_SAMPLE:
+        T_(scan_sample)(mc, by_columns, max_cols);
+        break;
+    case MC_ENGINE_DESCEND:
+    default:
+        T_(scan_descend)(mc, by_columns, max_cols);
+        break;
+    }
+
+    /* Find maximum allowed columns. */
+    for (cols = max_cols; 1 < cols; --cols) {
+        if (valid_test(mc, cols - 1)) {
+            break;
+        }
+    }
+
+    line_fmt = &COLUMN_INFO(mc)[cols - 1];
+    for (col = 0; col < cols; ++col) {
+        mc->widths[col] = line_fmt->col_arr[col];
+    }
+
+    return (cols);
+}
+
+/*
+ * Lay out both vertically and horizontally, and choose whichever
+ * takes fewer rows; on a tie, whichever has the narrower lines;
+ * on a tie again, vertically.  See mc_opt.auto_orientation.
+ *
+ * The candidates of both orientations that survive the length
+ * bounds, which do not depend on the orientation, are scanned
+ * together, in one pass: each length is read once and goes to both
+ * sets of candidates.  Vertical candidates use the column_info
+ * triangle and horizontal ones a triangle of their own; neither
+ * uses the valid bits, since a candidate is valid exactly if it
+ * is still live at the end of the pass.
+ *
+ * Leave the widths in mc->widths, the number of columns in *|colsp|,
+ * and return true to lay out vertically, false horizontally.
+ */
+
+static bool
+T_(calculate_auto)(mc_t *mc, size_t *colsp)
+{
+    struct T_(column_info) *column_info;
+    struct T_(column_info) *hinfo;
+    struct T_(cand) *live;
+    struct T_(cand) *vlive;
+    struct T_(cand) *hlive;
+    size_t max_cols = MIN(mc->max_idx, mc->nelem);
+    size_t limit = mc->llen - mc->indent;
+    const CELL_T *lenv = LENV(mc);
+    CELL_T *cells;
+    CELL_T *p;
+    bool *vfits;
+    bool *hfits;
+    size_t survivors;
+    size_t nv;
+    size_t nh;
+    size_t enr;
+    size_t i;
+    size_t vcols;
+    size_t hcols;
+    size_t vline;
+    size_t hline;
+    bool by_columns;
+    const struct T_(column_info) *chosen;
+    size_t cols;
+    size_t col;
+
+    T_(init_column_info)(mc);
+    column_info = COLUMN_INFO(mc);
+    survivors = T_(prune_candidates)(mc, max_cols, limit);
+
+    hinfo = (struct T_(column_info) *) xnmalloc(MAX(survivors, 1), sizeof (*hinfo));
+    cells = (CELL_T *) xnmalloc(MAX(survivors * (survivors + 1) / 2, 1), sizeof (*cells));
+    live = (struct T_(cand) *) xnmalloc(MAX(2 * survivors, 1), sizeof (*live));
+    vfits = (bool *) calloc(MAX(survivors, 1), sizeof (*vfits));
+    hfits = (bool *) calloc(MAX(survivors, 1), sizeof (*hfits));
+    if (hinfo == NULL || cells == NULL || live == NULL || vfits == NULL || hfits == NULL) {
+        xalloc_die();
+    }
+    for (i = 0, p = cells; i < survivors; ++i) {
+        size_t j;
+
+        hinfo[i].line_len = (i + 1) * MIN_COLUMN_WIDTH;
+        hinfo[i].col_arr = p;
+        for (j = 0; j <= i; ++j) {
+            p[j] = MIN_COLUMN_WIDTH;
+        }
+        p += i + 1;
+    }
+
+    /*
+     * Vertical candidates in the first half of |live|, horizontal
+     * ones in the second.  One column is the fallback either way,
+     * so it is not scanned.
+     */
+    vlive = live;
+    hlive = live + survivors;
+    nv = 0;
+    nh = 0;
+    for (i = 1; i < survivors; ++i) {
+        T_(cand_init)(&vlive[nv++], mc, i);
+        T_(cand_init)(&hlive[nh], mc, i);
+        hlive[nh++].ci = &hinfo[i];
+        vfits[i] = true;
+        hfits[i] = true;
+    }
+
+    for (enr = 0; enr < mc->nelem && nv + nh != 0; ++enr) {
+        size_t elem_length = lenv[enr];
+        size_t k;
+
+        k = 0;
+        while (k < nv) {
+            if (T_(cand_grow)(&vlive[k], elem_length, limit)) {
+                vfits[vlive[k].last] = false;
+                vlive[k] = vlive[--nv];
+                continue;
+            }
+            NEXT_VERTICAL(&vlive[k]);
+            ++k;
+        }
+        k = 0;
+        while (k < nh) {
+            if (T_(cand_grow)(&hlive[k], elem_length, limit)) {
+                hfits[hlive[k].last] = false;
+                hlive[k] = hlive[--nh];
+                continue;
+            }
+            NEXT_HORIZONTAL(&hlive[k]);
+            ++k;
+        }
+    }
+
+    for (vcols = survivors; vcols > 1 && !vfits[vcols - 1]; --vcols) {
+        continue;
+    }
+    for (hcols = survivors; hcols > 1 && !hfits[hcols - 1]; --hcols) {
+        continue;
+    }
+    vcols = MAX(vcols, 1);
+    hcols = MAX(hcols, 1);
+    vline = vcols > 1 ? column_info[vcols - 1].line_len : mc->max_len;
+    hline = hcols > 1 ? hinfo[hcols - 1].line_len : mc->max_len;
+
+    /* Rows are ceil(nelem / cols) either way, so more columns means fewer rows */
+    by_columns = (mc->nelem + vcols - 1) / vcols < (mc->nelem + hcols - 1) / hcols
+        || ((mc->nelem + vcols - 1) / vcols == (mc->nelem + hcols - 1) / hcols && vline <= hline);
+    cols = by_columns ? vcols : hcols;
+    chosen = by_columns ? &column_info[cols - 1] : &hinfo[cols - 1];
+    for (col = 0; col < cols; ++col) {
+        mc->widths[col] = cols > 1 ? chosen->col_arr[col] : MIN_COLUMN_WIDTH;
+    }
+
+    free(hfits);
+    free(vfits);
+    free(live);
+    free(cells);
+    free(hinfo);
+    *colsp = cols;
+    return (by_columns);
+}
+
+/*
+ * Lay out at each of several display widths, sharing the work between
+ * them.  |plans| must be sorted by decreasing llen.  See mc_plans().
+ *
+ * Whether a candidate fits depends on the limit, but its line length
+ * does not.  A candidate that overflowed at one limit overflows at
+ * every smaller one, and one that was evaluated completely has its
+ * exact line length, so each candidate is evaluated at most once,
+ * whatever the number of widths; after that, it is one comparison.
+ */
+
+static void
+T_(calculate_plans)(mc_t *mc, bool by_columns, size_t nplans, struct mc_plan **plans)
+{
+    struct T_(column_info) *column_info;
+    size_t max_cols_all = MIN(mc->max_idx, mc->nelem);
+    bool *tried;
+    size_t k;
+
+    T_(init_column_info)(mc);
+    column_info = COLUMN_INFO(mc);
+    tried = (bool *) calloc(max_cols_all, sizeof (*tried));
+    if (tried == NULL) {
+        xalloc_die();
+    }
+
+    for (k = 0; k < nplans; ++k) {
+        struct mc_plan *plan = plans[k];
+        size_t limit = plan->llen > mc->indent ? plan->llen - mc->indent : 0;
+        size_t max_cols = MIN(MAX(plan->llen / MIN_COLUMN_WIDTH, 1), max_cols_all);
+        size_t cols;
+        size_t col;
+        size_t i;
+
+        i = T_(prune_candidates)(mc, max_cols, limit);
+        for (cols = 1; i > 1; --i) {
+            struct T_(column_info) *ci = &column_info[i - 1];
+
+            if (!valid_test(mc, i - 1)) {
+                continue;
+            }
+            if (!tried[i - 1]) {
+                tried[i - 1] = true;
+                if (T_(try_columns)(mc, by_columns, i - 1, limit)) {
+                    cols = i;
+                    break;
+                }
+            }
+            else if (ci->line_len < limit || ci->line_len == i * MIN_COLUMN_WIDTH) {
+                cols = i;
+                break;
+            }
+            else {
+                valid_clear(mc, i - 1);
+            }
+        }
+
+        plan->cols = cols;
+        plan->rows = (mc->nelem + cols - 1) / cols;
+        plan->widths = (size_t *) xnmalloc(cols, sizeof (*plan->widths));
+        if (plan->widths == NULL) {
+            xalloc_die();
+        }
+        for (col = 0; col < cols; ++col) {
+            plan->widths[col] = column_info[cols - 1].col_arr[col];
+        }
+        if (cols == 1) {
+            plan->widths[0] = MAX(mc->max_len, MIN_COLUMN_WIDTH);
+        }
+    }
+
+    free(tried);
+}
+
+/*
+ * The breakpoint table of a list, for every display width up to
+ * mc->llen.  See mc_breakpoints().
+ *
+ * Candidate i + 1 is valid at width w as soon as w allows that many
+ * columns and its line length, which does not depend on w, fits
+ * what w leaves after the indentation.  So each candidate has a
+ * threshold, the narrowest width at which it is valid, and the
+ * layout at w is the widest candidate whose threshold is at most w.
+ * Going from the most columns down, a candidate matters only if its
+ * threshold is below that of every wider candidate; anything else
+ * is abandoned as soon as its line length shows it cannot be, so
+ * each candidate is evaluated once, and most only partly.
+ *
+ * Fill |table| with one plan for each candidate that matters,
+ * by increasing llen, which is then its threshold, and return
+ * how many there are.  |table| needs room for max_idx plans.
+ */
+
+static size_t
+T_(calculate_breakpoints)(mc_t *mc, bool by_columns, struct mc_plan *table)
+{
+    struct T_(column_info) *column_info;
+    size_t max_cols = MIN(mc->max_idx, mc->nelem);
+    size_t limit = mc->llen > mc->indent ? mc->llen - mc->indent : 0;
+    size_t best = mc->llen + 1;     /* Threshold of the best so far */
+    size_t nbreak;
+    size_t col;
+    size_t i;
+    size_t k;
+
+    T_(init_column_info)(mc);
+    column_info = COLUMN_INFO(mc);
+
+    nbreak = 0;
+    for (i = T_(prune_candidates)(mc, max_cols, limit); i > 1; --i) {
+        size_t cols_min = i * MIN_COLUMN_WIDTH;
+        size_t fits = best > mc->indent + 1 ? best - mc->indent - 1 : 0;
+        size_t line_len;
+        size_t threshold;
+        struct mc_plan *plan;
+
+        if (cols_min >= best) {
+            continue;
+        }
+        if (!T_(try_columns)(mc, by_columns, i - 1, fits)) {
+            continue;
+        }
+
+        line_len = column_info[i - 1].line_len;
+        threshold = line_len == cols_min ? mc->indent + 1 : line_len + mc->indent + 1;
+        threshold = MAX(threshold, cols_min);
+        if (threshold >= best) {
+            continue;
+        }
+        plan = &table[nbreak++];
+        plan->llen = threshold;
+        plan->cols = i;
+        plan->widths = (size_t *) xnmalloc(i, sizeof (*plan->widths));
+        if (plan->widths == NULL) {
+            xalloc_die();
+        }
+        for (col = 0; col < i; ++col) {
+            plan->widths[col] = column_info[i - 1].col_arr[col];
+        }
+        best = plan->llen;
+    }
+
+    table[nbreak].llen = 1;
+    table[nbreak].cols = 1;
+    table[nbreak].widths = (size_t *) xnmalloc(1, sizeof (*table[nbreak].widths));
+    if (table[nbreak].widths == NULL) {
+        xalloc_die();
+    }
+    table[nbreak].widths[0] = MAX(mc->max_len, MIN_COLUMN_WIDTH);
+    ++nbreak;
+
+    // Found from the most columns down; give them from the narrowest up
+    for (k = 0; k < nbreak / 2; ++k) {
+        struct mc_plan tmp = table[k];
+
+        table[k] = table[nbreak - 1 - k];
+        table[nbreak - 1 - k] = tmp;
+    }
+    for (k = 0; k < nbreak; ++k) {
+        table[k].rows = (mc->nelem + table[k].cols - 1) / table[k].cols;
+    }
+    return (nbreak);
+}
+
+/*
+ * The narrowest display width, up to mc->llen, whose layout has at
+ * most |max_rows| rows, and that layout.  See mc_fit_rows().
+ *
+ * With thresholds as in calculate_breakpoints(), the layout at
+ * width w has at most max_rows rows as soon as some candidate of at
+ * least cols_min = ceil(nelem / max_rows) columns has its threshold
+ * at most w.  So the answer is the lowest threshold of those
+ * candidates.  They are evaluated from cols_min up, each abandoned
+ * as soon as it cannot beat the best so far, until even the minimum
+ * width of a candidate cannot.  On a tie, the wider candidate wins,
+ * as it would in calculate_columns().
+ *
+ * Return false if no width up to mc->llen will do.
+ */
+
+static bool
+T_(calculate_fit)(mc_t *mc, bool by_columns, size_t max_rows, struct mc_plan *plan)
+{
+    struct T_(column_info) *column_info;
+    size_t max_cols = MIN(mc->max_idx, mc->nelem);
+    size_t cols_min = (mc->nelem + max_rows - 1) / max_rows;
+    size_t best = mc->llen;         /* Threshold of the best so far */
+    size_t cols = 0;
+    size_t col;
+    size_t i;
+
+    // One column fits at any width with room for the indentation
+    if (cols_min <= 1 && mc->indent < mc->llen) {
+        cols = 1;
+        best = mc->indent + 1;
+    }
+
+    T_(init_column_info)(mc);
+    column_info = COLUMN_INFO(mc);
+
+    for (i = MAX(cols_min, 2); i <= max_cols; ++i) {
+        size_t cols_min_width = i * MIN_COLUMN_WIDTH;
+        size_t fits = best > mc->indent ? best - mc->indent : 0;
+        size_t line_len;
+        size_t threshold;
+
+        if (cols_min_width > best) {
+            break;
+        }
+        if (!T_(try_columns)(mc, by_columns, i - 1, fits)) {
+            continue;
+        }
+
+        line_len = column_info[i - 1].line_len;
+        threshold = line_len == cols_min_width ? mc->indent + 1 : line_len + mc->indent + 1;
+        threshold = MAX(threshold, cols_min_width);
+        if (threshold <= best) {
+            best = threshold;
+            cols = i;
+        }
+    }
+
+    if (cols == 0) {
+        return (false);
+    }
+    plan->llen = best;
+    plan->cols = cols;
+    plan->rows = (mc->nelem + cols - 1) / cols;
+    plan->widths = (size_t *) xnmalloc(cols, sizeof (*plan->widths));
+    if (plan->widths == NULL) {
+        xalloc_die();
+    }
+    for (col = 0; col < cols; ++col) {
+        plan->widths[col] = column_info[cols - 1].col_arr[col];
+    }
+    if (cols == 1) {
+        plan->widths[0] = MAX(mc->max_len, MIN_COLUMN_WIDTH);
+    }
+    return (true);
+}
+
+/*
+ * The layout with the fewest columns that fits in |max_rows| rows,
+ * whatever its width.  See mc_plan_rows().
+ *
+ * The number of columns follows from the number of rows alone, so
+ * there is no candidate to search for, and no column_info triangle:
+ * the widths come from one pass over the lengths.  Lengths clamped
+ * to mc->len_cap are measured again, since the width is not bounded.
+ */
+
+static void
+T_(calculate_rows)(mc_t *mc, bool by_columns, size_t max_rows, struct mc_plan *plan)
+{
+    const CELL_T *lenv = LENV(mc);
+    size_t cols = (mc->nelem + max_rows - 1) / max_rows;
+    size_t rows = (mc->nelem + cols - 1) / cols;
+    size_t *widths;
+    size_t line_len;
+    size_t col;
+    size_t enr;
+
+    widths = (size_t *) xnmalloc(cols, sizeof (*widths));
+    if (widths == NULL) {
+        xalloc_die();
+    }
+    if (by_columns) {
+        size_t start;
+
+        for (col = 0, start = 0; col < cols; ++col, start += rows) {
+            size_t n = MIN(rows, mc->nelem - start);
+
+            widths[col] = T_(simd_max)(lenv + start, n);
+            if (widths[col] >= mc->len_cap) {
+                for (enr = start; enr < start + n; ++enr) {
+                    widths[col] = MAX(widths[col], elem_length(mc, enr));
+                }
+            }
+        }
+    }
+    else {
+        memset(widths, 0, cols * sizeof (*widths));
+        for (enr = 0, col = 0; enr < mc->nelem; ++enr) {
+            size_t len = lenv[enr];
+
+            if (len >= mc->len_cap) {
+                len = elem_length(mc, enr);
+            }
+            widths[col] = MAX(widths[col], len);
+            if (++col == cols) {
+                col = 0;
+            }
+        }
+    }
+
+    line_len = 0;
+    for (col = 0; col < cols; ++col) {
+        widths[col] = MAX(widths[col] + (col + 1 == cols ? 0 : 2), MIN_COLUMN_WIDTH);
+        line_len += widths[col];
+    }
+
+    plan->llen = mc->indent + line_len;
+    plan->cols = cols;
+    plan->rows = rows;
+    plan->widths = widths;
+}
+
+#undef LENV
+#undef COLUMN_INFO
+#undef T_
+#undef CELL_T
+#undef CELL_BITS
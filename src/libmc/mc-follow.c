@@ -0,0 +1,657 @@
+/*
+ * Filename: src/libmc/mc-follow.c
+ * Project: libmc
+ * Brief: Incremental layout of a list that only ever grows
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+    // Import type bool
+    // Import constant false
+    // Import constant true
+#include <stdio.h>
+    // Import type FILE
+#include <stdlib.h>
+    // Import calloc()
+    // Import free()
+#include <string.h>
+    // Import memcpy()
+#include <unistd.h>
+    // Import type size_t
+
+#include <libmc.h>
+#include "mc-private.h"
+
+/*
+ * The batch engines lay out a whole list at once.  A list that is
+ * being followed, as it grows, would have to be laid out again
+ * from scratch every time it is shown.  Instead, the state of every
+ * candidate number of columns is kept up to date as each element
+ * is appended, and the best candidate is known at any time.
+ *
+ * The layout is exactly the one the batch engines choose, for the
+ * same elements.  Column j of candidate c is MIN_COLUMN_WIDTH wide,
+ * or as wide as its longest element, plus 2 for the separating white
+ * space, except in the last column.  A candidate fits if its line is
+ * shorter than the limit, or if no element is wider than the minimum.
+ *
+ * Horizontal:
+ *     Element n goes in column n % c, whatever comes after it,
+ *     so appending updates one column of each candidate.
+ *     A candidate that no longer fits never will again, and is
+ *     not looked at any more.
+ *
+ * Vertical:
+ *     With rows = ceil(nelem / c), element n goes in column n / rows.
+ *     As long as rows does not change, appending only updates the
+ *     last column in use.  Every c appends, rows grows by one,
+ *     every element moves, and the maxima of the columns are
+ *     found again, each with a range-maximum query on a segment tree
+ *     of all lengths, in O(log nelem), until the line is too long.
+ *     That is at most O(log nelem) per candidate per append, amortized.
+ *     Columns can get narrower, so every candidate is kept, fitting
+ *     or not.
+ *
+ * With a window (mc_opt.window), only the last window elements
+ * are laid out, and each append past that evicts the oldest.
+ * Vertical, the lengths in the window are kept in a ring, under the
+ * segment tree.
+ *
+ * Horizontal, with a window:
+ *     Every element moves to the next column on each eviction, but
+ *     the elements that share a column stay the same: those whose
+ *     position in the whole list is the same modulo c.  Only which
+ *     of these classes is the last column changes.  The maximum of
+ *     each class, over the window, is kept in a monotonic deque,
+ *     so an append costs O(1) per candidate, amortized.  A deque
+ *     holds only the lengths that are larger than all those after
+ *     them, which is rarely more than a few, so its slots are
+ *     allocated as it fills, never more than its class can hold.
+ *     Room for the whole window in every class of every candidate
+ *     would take O(max_idx * window) memory up front.
+ *
+ * Vertical, with a window:
+ *     Every eviction moves every column boundary by one: each column
+ *     loses its first element and gains one.  Only when the element
+ *     lost was the longest in its column is a query needed.  A
+ *     candidate whose first few columns already make the line too long
+ *     keeps up only those.  So an append costs O(c) per candidate,
+ *     plus O(log window) per column whose longest element was lost.
+ */
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/*
+ * Positions in the list, and their lengths, in a ring, oldest first.
+ * The largest length is at the front, and every length is larger
+ * than all of those behind it.
+ */
+struct mc_slot {
+    size_t pos;
+    size_t len;
+};
+
+struct mc_deque {
+    struct mc_slot *slot;
+    size_t cap;
+    size_t head;
+    size_t count;
+};
+
+struct mc_cand {
+    size_t rows;        /* Vertical: rows at the last full update */
+    size_t line_len;
+    size_t sum;         /* Horizontal, with a window: sum of the widths
+                         * of all classes, as if none were the last */
+    struct mc_deque *dq;    /* Horizontal, with a window: one per class */
+    bool overflowed;    /* Does not fit: for good, if horizontal;
+                         * until rows changes, if vertical */
+    size_t known;       /* Vertical: colmax[0 .. known) is exact */
+    size_t *colmax;     /* Longest element in each column; 0 if empty */
+};
+
+struct mc_follow {
+    bool by_columns;
+    size_t max_idx;     /* Most columns possible */
+    size_t limit;       /* Lines must be shorter than this */
+    size_t nelem;       /* Appended so far, evicted or not */
+    size_t window;      /* 0: no window */
+    size_t *tree;       /* Segment tree; leaves at tree[cap ..] */
+    size_t cap;
+    struct mc_cand *cand;   /* cand[c - 1] is for c columns */
+    struct mc_widths widths;
+};
+
+static inline size_t
+col_width(size_t c, size_t j, size_t colmax)
+{
+    return (MAX(MIN_COLUMN_WIDTH, colmax + (j == c - 1 ? 0 : 2)));
+}
+
+static bool
+cand_fits(const struct mc_follow *fl, size_t c)
+{
+    const struct mc_cand *cd = &fl->cand[c - 1];
+
+    if (cd->overflowed) {
+        return (false);
+    }
+    return (cd->line_len < fl->limit || cd->line_len == c * MIN_COLUMN_WIDTH);
+}
+
+/*
+ * Largest length in [lo, hi).
+ */
+
+static size_t
+range_max(const struct mc_follow *fl, size_t lo, size_t hi)
+{
+    size_t m = 0;
+
+    for (lo += fl->cap, hi += fl->cap; lo < hi; lo /= 2, hi /= 2) {
+        if (lo & 1) {
+            m = MAX(m, fl->tree[lo]);
+            ++lo;
+        }
+        if (hi & 1) {
+            --hi;
+            m = MAX(m, fl->tree[hi]);
+        }
+    }
+    return (m);
+}
+
+/*
+ * First position in the window, and the number of elements in it.
+ */
+
+static inline size_t
+window_start(const struct mc_follow *fl)
+{
+    return (fl->window != 0 && fl->nelem > fl->window ? fl->nelem - fl->window : 0);
+}
+
+static inline size_t
+window_len(const struct mc_follow *fl)
+{
+    return (fl->nelem - window_start(fl));
+}
+
+/*
+ * Largest length of the elements at positions [lo, hi) of the list,
+ * all of which must still be in the window.
+ */
+
+static size_t
+window_max(const struct mc_follow *fl, size_t lo, size_t hi)
+{
+    size_t w = fl->window;
+    size_t r;
+
+    if (w == 0) {
+        return (range_max(fl, lo, hi));
+    }
+    r = lo % w;
+    if (r + (hi - lo) <= w) {
+        return (range_max(fl, r, r + (hi - lo)));
+    }
+    return (MAX(range_max(fl, r, w), range_max(fl, 0, r + (hi - lo) - w)));
+}
+
+static void
+tree_append(struct mc_follow *fl, size_t len)
+{
+    size_t k;
+
+    if (fl->window == 0 && fl->nelem == fl->cap) {
+        size_t cap = fl->cap ? 2 * fl->cap : 1024;
+        size_t *tree;
+
+        tree = (size_t *) xnmalloc(2 * cap, sizeof (*tree));
+        if (tree == NULL) {
+            xalloc_die();
+        }
+        if (fl->nelem != 0) {
+            memcpy(tree + cap, fl->tree + fl->cap, fl->nelem * sizeof (*tree));
+        }
+        for (k = cap + fl->nelem; k < 2 * cap; ++k) {
+            tree[k] = 0;
+        }
+        for (k = cap - 1; k >= 1; --k) {
+            tree[k] = MAX(tree[2 * k], tree[2 * k + 1]);
+        }
+        free(fl->tree);
+        fl->tree = tree;
+        fl->cap = cap;
+    }
+
+    k = fl->cap + (fl->window ? fl->nelem % fl->window : fl->nelem);
+    fl->tree[k] = len;
+    for (; k > 1; k /= 2) {
+        fl->tree[k / 2] = MAX(fl->tree[k], fl->tree[k ^ 1]);
+    }
+}
+
+static void
+cand_update(struct mc_cand *cd, size_t c, size_t j, size_t len)
+{
+    if (len > cd->colmax[j]) {
+        cd->line_len -= col_width(c, j, cd->colmax[j]);
+        cd->colmax[j] = len;
+        cd->line_len += col_width(c, j, len);
+    }
+}
+
+/*
+ * Find the maxima of all columns again, after rows has changed.
+ * Give up as soon as the line is known to be too long: once some
+ * column is wider than the minimum, the rest can only add to it.
+ * Until rows changes again, the columns only get wider, so the
+ * candidate is not looked at until then.
+ */
+
+static inline bool
+prefix_too_long(const struct mc_follow *fl, const struct mc_cand *cd, size_t k)
+{
+    return (cd->line_len >= fl->limit && cd->line_len > k * MIN_COLUMN_WIDTH);
+}
+
+/*
+ * Find the maxima of columns |j| and up, adding to line_len,
+ * until the line is known to be too long.
+ */
+
+static void
+cand_extend(struct mc_follow *fl, struct mc_cand *cd, size_t c, size_t j)
+{
+    size_t start = window_start(fl);
+    size_t nelem = window_len(fl);
+    size_t rows = cd->rows;
+
+    cd->overflowed = false;
+    for (; j < c; ++j) {
+        size_t lo = j * rows;
+
+        cd->colmax[j] = lo < nelem ? window_max(fl, start + lo, start + MIN(lo + rows, nelem)) : 0;
+        cd->line_len += col_width(c, j, cd->colmax[j]);
+        if (prefix_too_long(fl, cd, j + 1)) {
+            cd->overflowed = true;
+            cd->known = j + 1;
+            return;
+        }
+    }
+    cd->known = c;
+}
+
+static void
+cand_rebuild(struct mc_follow *fl, struct mc_cand *cd, size_t c, size_t rows)
+{
+    cd->rows = rows;
+    cd->line_len = 0;
+    cand_extend(fl, cd, c, 0);
+}
+
+static inline size_t
+length_at(const struct mc_follow *fl, size_t pos)
+{
+    return (fl->tree[fl->cap + pos % fl->window]);
+}
+
+/*
+ * Vertical, with a full window, after the element of length |gone|
+ * was evicted, and one appended: every column loses its first element
+ * and gains the first of the next column, or the new one.  Unless the
+ * element lost was the only longest, the maximum is known without
+ * a query.
+ * Only the columns known to make the line too long are kept up.
+ */
+
+static void
+cand_slide(struct mc_follow *fl, struct mc_cand *cd, size_t c, size_t gone)
+{
+    size_t w = fl->window;
+    size_t rows = cd->rows;
+    size_t s0 = window_start(fl) - 1;
+    size_t known = cd->known;
+    size_t j;
+
+    cd->line_len = 0;
+    for (j = 0; j < known; ++j) {
+        size_t lo = j * rows;
+
+        if (lo < w) {
+            size_t hi = MIN(lo + rows, w);
+            size_t out = j == 0 ? gone : length_at(fl, s0 + lo);
+            size_t in = length_at(fl, s0 + hi);
+
+            if (in >= cd->colmax[j]) {
+                cd->colmax[j] = in;
+            }
+            else if (out >= cd->colmax[j]) {
+                cd->colmax[j] = window_max(fl, s0 + lo + 1, s0 + hi + 1);
+            }
+        }
+        cd->line_len += col_width(c, j, cd->colmax[j]);
+        if (prefix_too_long(fl, cd, j + 1)) {
+            cd->overflowed = true;
+            cd->known = j + 1;
+            return;
+        }
+    }
+    cand_extend(fl, cd, c, known);
+}
+
+static inline size_t
+deque_max(const struct mc_deque *dq)
+{
+    return (dq->count ? dq->slot[dq->head].len : 0);
+}
+
+/*
+ * Make room for one more slot at the back of a full deque,
+ * up to |most| slots in all.
+ */
+
+static void
+deque_grow(struct mc_deque *dq, size_t most)
+{
+    struct mc_slot *slot;
+    size_t cap;
+    size_t k;
+
+    cap = MIN(MAX(2 * dq->cap, 4), most);
+    slot = (struct mc_slot *) xnmalloc(cap, sizeof (*slot));
+    if (slot == NULL) {
+        xalloc_die();
+    }
+    for (k = 0; k < dq->count; ++k) {
+        slot[k] = dq->slot[(dq->head + k) % dq->cap];
+    }
+    free(dq->slot);
+    dq->slot = slot;
+    dq->cap = cap;
+    dq->head = 0;
+}
+
+/*
+ * Horizontal, with a window: the line of candidate |c| is the sum of
+ * the widths of its classes, but the last column has no white space
+ * after it.  The last column is the class of the last position
+ * of the first row.
+ */
+
+static void
+window_line(const struct mc_follow *fl, struct mc_cand *cd, size_t c)
+{
+    size_t m = deque_max(&cd->dq[(window_start(fl) + c - 1) % c]);
+
+    cd->line_len = cd->sum - MAX(MIN_COLUMN_WIDTH, m + 2) + MAX(MIN_COLUMN_WIDTH, m);
+}
+
+static void
+window_update(struct mc_follow *fl, struct mc_cand *cd, size_t c, size_t pos, size_t len)
+{
+    struct mc_deque *dq;
+
+    // Evict the element that has just left the window
+    if (pos >= fl->window) {
+        size_t old = pos - fl->window;
+
+        dq = &cd->dq[old % c];
+        if (dq->count != 0 && dq->slot[dq->head].pos == old) {
+            cd->sum -= MAX(MIN_COLUMN_WIDTH, deque_max(dq) + 2);
+            dq->head = (dq->head + 1) % dq->cap;
+            --dq->count;
+            cd->sum += MAX(MIN_COLUMN_WIDTH, deque_max(dq) + 2);
+        }
+    }
+
+    dq = &cd->dq[pos % c];
+    cd->sum -= MAX(MIN_COLUMN_WIDTH, deque_max(dq) + 2);
+    while (dq->count != 0 && dq->slot[(dq->head + dq->count - 1) % dq->cap].len <= len) {
+        --dq->count;
+    }
+    if (dq->count == dq->cap) {
+        // No class has more than ceil(window / c) positions in the window
+        deque_grow(dq, MIN(fl->window, (fl->window + c - 1) / c + 1));
+    }
+    dq->slot[(dq->head + dq->count) % dq->cap].pos = pos;
+    dq->slot[(dq->head + dq->count) % dq->cap].len = len;
+    ++dq->count;
+    cd->sum += MAX(MIN_COLUMN_WIDTH, deque_max(dq) + 2);
+
+    window_line(fl, cd, c);
+}
+
+static size_t
+cand_colmax(const struct mc_follow *fl, const struct mc_cand *cd, size_t c, size_t j)
+{
+    if (cd->dq != NULL) {
+        return (deque_max(&cd->dq[(window_start(fl) + j) % c]));
+    }
+    return (cd->colmax[j]);
+}
+
+/*
+ * Start following a list, laid out with |opt|.
+ */
+
+mc_follow_t *
+mc_follow_new(const mc_opt_t *opt)
+{
+    mc_follow_t *fl;
+    size_t *cells;
+    size_t c;
+
+    fl = (mc_follow_t *) xnmalloc(1, sizeof (*fl));
+    if (fl == NULL) {
+        xalloc_die();
+    }
+    fl->by_columns = !opt->horizontal;
+    fl->max_idx = MAX(opt->llen / MIN_COLUMN_WIDTH, 1);
+    fl->limit = opt->llen - opt->indent;
+    fl->nelem = 0;
+    fl->window = opt->window;
+    fl->tree = NULL;
+    fl->cap = 0;
+    mc_widths_init(&fl->widths);
+
+    if (fl->window != 0 && fl->by_columns) {
+        // The ring of lengths never grows
+        for (fl->cap = 1; fl->cap < fl->window; fl->cap *= 2) {
+            continue;
+        }
+        fl->tree = (size_t *) calloc(2 * fl->cap, sizeof (*fl->tree));
+        if (fl->tree == NULL) {
+            xalloc_die();
+        }
+    }
+
+    fl->cand = (struct mc_cand *) xnmalloc(fl->max_idx, sizeof (*fl->cand));
+    cells = (size_t *) calloc(fl->max_idx * (fl->max_idx + 1) / 2, sizeof (*cells));
+    if (fl->cand == NULL || cells == NULL) {
+        xalloc_die();
+    }
+    for (c = 1; c <= fl->max_idx; ++c) {
+        struct mc_cand *cd = &fl->cand[c - 1];
+
+        cd->rows = 0;
+        cd->line_len = c * MIN_COLUMN_WIDTH;
+        cd->sum = c * MIN_COLUMN_WIDTH;
+        cd->known = 0;
+        cd->dq = NULL;
+        cd->overflowed = false;
+        cd->colmax = cells;
+        cells += c;
+
+        if (fl->window != 0 && !fl->by_columns) {
+            // Slots come later, as each deque fills; see deque_grow()
+            size_t r;
+
+            cd->dq = (struct mc_deque *) xnmalloc(c, sizeof (*cd->dq));
+            if (cd->dq == NULL) {
+                xalloc_die();
+            }
+            for (r = 0; r < c; ++r) {
+                cd->dq[r].slot = NULL;
+                cd->dq[r].cap = 0;
+                cd->dq[r].head = 0;
+                cd->dq[r].count = 0;
+            }
+        }
+    }
+    return (fl);
+}
+
+void
+mc_follow_free(mc_follow_t *fl)
+{
+    size_t c;
+
+    if (fl == NULL) {
+        return;
+    }
+    for (c = 1; c <= fl->max_idx; ++c) {
+        struct mc_deque *dq = fl->cand[c - 1].dq;
+        size_t r;
+
+        if (dq != NULL) {
+            for (r = 0; r < c; ++r) {
+                free(dq[r].slot);
+            }
+            free(dq);
+        }
+    }
+    free(fl->cand[0].colmax);
+    free(fl->cand);
+    free(fl->tree);
+    mc_widths_fini(&fl->widths);
+    free(fl);
+}
+
+/*
+ * Append an element of length |len|.
+ * With a window, and a full window, evict the oldest.
+ */
+
+void
+mc_follow_add(mc_follow_t *fl, size_t len)
+{
+    size_t n = fl->nelem;
+    bool evict = fl->window != 0 && n >= fl->window;
+    size_t gone = 0;
+    size_t nelem;
+    size_t c;
+
+    if (fl->by_columns) {
+        if (evict) {
+            gone = length_at(fl, n - fl->window);
+        }
+        tree_append(fl, len);
+    }
+    fl->nelem = n + 1;
+    nelem = window_len(fl);
+
+    for (c = 1; c <= fl->max_idx; ++c) {
+        struct mc_cand *cd = &fl->cand[c - 1];
+
+        if (cd->dq != NULL) {
+            window_update(fl, cd, c, n, len);
+        }
+        else if (fl->by_columns) {
+            size_t rows = (nelem + c - 1) / c;
+
+            /*
+             * Columns that were given up on, as the list grew,
+             * are not exact, so start the window afresh once it is full.
+             */
+            if (rows != cd->rows || n == fl->window) {
+                cand_rebuild(fl, cd, c, rows);
+            }
+            else if (evict) {
+                cand_slide(fl, cd, c, gone);
+            }
+            else if (!cd->overflowed) {
+                cand_update(cd, c, n / rows, len);
+                cd->overflowed = !cand_fits(fl, c);
+            }
+        }
+        else if (!cd->overflowed) {
+            cand_update(cd, c, n % c, len);
+            cd->overflowed = !cand_fits(fl, c);
+        }
+    }
+}
+
+/*
+ * Number of columns of the best layout of the elements so far.
+ */
+
+size_t
+mc_follow_columns(const mc_follow_t *fl)
+{
+    size_t c;
+
+    for (c = MIN(fl->max_idx, window_len(fl)); c > 1; --c) {
+        if (cand_fits(fl, c)) {
+            return (c);
+        }
+    }
+    return (1);
+}
+
+/*
+ * Print |elemv|, which must be the elements appended so far, or the
+ * ones in the window, with the current layout.  |opt| must be the
+ * options the list is being followed with.  Returns what mc_print()
+ * returns.
+ */
+
+int
+mc_follow_print(mc_follow_t *fl, FILE *f, size_t nelem, const char **elemv,
+    const mc_opt_t *opt)
+{
+    const struct mc_cand *cd;
+    mc_opt_t fopt;
+    size_t cols;
+    size_t j;
+
+    cols = mc_follow_columns(fl);
+    cd = &fl->cand[cols - 1];
+    if (fl->widths.alloc < cols) {
+        free(fl->widths.widths);
+        fl->widths.widths = (size_t *) xnmalloc(cols, sizeof (*fl->widths.widths));
+        if (fl->widths.widths == NULL) {
+            xalloc_die();
+        }
+        fl->widths.alloc = cols;
+    }
+    for (j = 0; j < cols; ++j) {
+        fl->widths.widths[j] = col_width(cols, j, cand_colmax(fl, cd, cols, j));
+    }
+    fl->widths.cols = cols;
+
+    /*
+     * The widths are exactly those the batch engines would find,
+     * so mc_print() takes them as they are, without a layout pass.
+     */
+    fopt = *opt;
+    fopt.stable = &fl->widths;
+    return (mc_print(f, nelem, elemv, &fopt));
+}
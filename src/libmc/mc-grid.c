@@ -0,0 +1,166 @@
+/*
+ * Filename: src/libmc/mc-grid.c
+ * Project: libmc
+ * Brief: Stream elements into a grid of fixed geometry
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+    // Import var errno
+    // Import constant EIO
+#include <stdio.h>
+    // Import type FILE
+    // Import fwrite()
+#include <unistd.h>
+    // Import type size_t
+
+#include <libmc.h>
+#include "mc-private.h"
+
+/*
+ * When the caller already knows how many columns there are, and how
+ * wide they are, a horizontal layout needs no knowledge of the rest
+ * of the list.  Each element is written as soon as it is given,
+ * and nothing is kept but the position in the current row.
+ *
+ * Columns are separated by GRID_GAP spaces.  The padding after
+ * an element is only written once the next element is known to go
+ * on the same row, so no line ends in white space.
+ *
+ * An element wider than a column is either cut to the width of
+ * the column (MC_OVERFLOW_TRUNCATE) or written in full, taking up
+ * as many columns as it needs, starting a new row if they do not
+ * fit in the current one (MC_OVERFLOW_SPAN).
+ */
+
+#define GRID_GAP 2
+
+static int
+grid_write(mc_grid_t *grid, const char *p, size_t len)
+{
+    if (grid->err == 0 && fwrite(p, 1, len, grid->f) != len) {
+        grid->err = errno ? errno : EIO;
+    }
+    return (grid->err);
+}
+
+static int
+grid_blanks(mc_grid_t *grid, size_t n)
+{
+    while (n != 0 && grid->err == 0) {
+        size_t chunk = n < sizeof (mc_blanks) ? n : sizeof (mc_blanks);
+
+        grid_write(grid, mc_blanks, chunk);
+        n -= chunk;
+    }
+    return (grid->err);
+}
+
+void
+mc_grid_init(mc_grid_t *grid, FILE *f, const mc_opt_t *opt)
+{
+    grid->f = f;
+    grid->cols = opt->columns;
+    grid->width = opt->col_width;
+    grid->indent = opt->indent;
+    grid->overflow = opt->overflow;
+    grid->col = 0;
+    grid->pad = 0;
+    grid->err = 0;
+
+    /*
+     * Derive whichever of the number of columns and their width
+     * was not given from the other, and the line length.
+     */
+    if (grid->cols == 0 && grid->width != 0) {
+        size_t room = opt->llen > grid->indent ? opt->llen - grid->indent : 0;
+
+        grid->cols = (room + GRID_GAP) / (grid->width + GRID_GAP);
+    }
+    else if (grid->width == 0 && grid->cols != 0) {
+        size_t room = opt->llen > grid->indent ? opt->llen - grid->indent : 0;
+        size_t gaps = (grid->cols - 1) * GRID_GAP;
+
+        grid->width = room > gaps ? (room - gaps) / grid->cols : 0;
+    }
+    if (grid->cols == 0) {
+        grid->cols = 1;
+    }
+    if (grid->width == 0) {
+        grid->width = 1;
+    }
+}
+
+/*
+ * Finish the current row, if one has been started.
+ */
+
+int
+mc_grid_end(mc_grid_t *grid)
+{
+    if (grid->col != 0) {
+        grid_write(grid, "\n", 1);
+        grid->col = 0;
+        grid->pad = 0;
+    }
+    return (grid->err);
+}
+
+/*
+ * Write one element of |len| bytes.
+ * Return 0, or the errno value of the first write that failed.
+ */
+
+int
+mc_grid_put(mc_grid_t *grid, const char *elem, size_t len)
+{
+    size_t span = 1;
+    size_t room;
+
+    if (grid->err != 0) {
+        return (grid->err);
+    }
+
+    if (len > grid->width) {
+        if (grid->overflow == MC_OVERFLOW_SPAN) {
+            span = (len + GRID_GAP + grid->width + GRID_GAP - 1) / (grid->width + GRID_GAP);
+        }
+        else {
+            len = grid->width;
+        }
+    }
+    if (grid->col != 0 && grid->col + span > grid->cols) {
+        mc_grid_end(grid);
+    }
+
+    if (grid->col == 0) {
+        grid_blanks(grid, grid->indent);
+    }
+    else {
+        grid_blanks(grid, grid->pad);
+    }
+    grid_write(grid, elem, len);
+
+    room = span * (grid->width + GRID_GAP);
+    grid->pad = room > len ? room - len : 0;
+    grid->col += span;
+    if (grid->col >= grid->cols) {
+        mc_grid_end(grid);
+    }
+    return (grid->err);
+}
@@ -0,0 +1,46 @@
+/*
+ * Filename: src/libmc/mc-private.h
+ * Project: libmc
+ * Brief: Constants and helpers shared by the parts of libmc
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MC_PRIVATE_H
+#define _MC_PRIVATE_H
+
+#include <sys/types.h>      // Import size_t
+
+/*
+ * The minimum width of a column is 3:
+ *     1 character for the name, and
+ *     2 for the separating white space.
+ */
+#define MIN_COLUMN_WIDTH 3
+
+/*
+ * A run of blanks, for indentation and padding, written from
+ * in place, a piece at a time.  Defined in mc.c.
+ */
+extern const char mc_blanks[256];
+
+// Defined in mc.c
+extern void *xnmalloc(size_t n, size_t s);
+extern void *xnrealloc(void *p, size_t n, size_t s);
+extern void xalloc_die(void);
+
+#endif  /* _MC_PRIVATE_H */
@@ -0,0 +1,431 @@
+/*
+ * Filename: src/libmc/mc-simd.c
+ * Project: libmc
+ * Brief: Vectorized kernels, built for several instruction sets,
+ *        with the best one chosen once, at run time
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+    // Import type pthread_once_t
+    // Import constant PTHREAD_ONCE_INIT
+    // Import pthread_once()
+#include <stdint.h>
+    // Import type uint16_t
+    // Import type uint32_t
+    // Import type uint64_t
+    // Import type uintptr_t
+#include <stdlib.h>
+    // Import getenv()
+#include <string.h>
+    // Import memchr()
+    // Import strcmp()
+    // Import strlen()
+#include <unistd.h>
+    // Import type size_t
+
+#include <libmc.h>
+#include "mc-simd.h"
+
+/*
+ * One binary runs on old SSE2-only machines and on newer machines
+ * with AVX2 or AVX-512.  Each kernel is compiled for each instruction
+ * set, using GCC target attributes, so nothing in this file requires
+ * more than the baseline to be enabled on the command line.
+ *
+ * mc_simd_select() picks the best variant that the CPU supports,
+ * once, the first time libmc is used, under pthread_once(), since
+ * several threads, or several callers, may be the first.  The
+ * environment variable MC_SIMD can name a variant (generic, sse2,
+ * avx2, avx512) to force it, for testing.  A variant the CPU does not
+ * support is never used.
+ *
+ * Every kernel only ever reads memory within the aligned vector that
+ * holds a byte it was asked to look at, so it can never fault by
+ * reading past the end of a page.  The strlen kernels still read
+ * bytes past the nul, which AddressSanitizer would report, so they
+ * are not instrumented.
+ */
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+// ################ generic
+
+static size_t
+generic_strlen(const char *s)
+{
+    return (strlen(s));
+}
+
+static const char *
+generic_find_byte(const char *p, const char *end, int c)
+{
+    const char *r;
+
+    if (p >= end) {
+        return (end);
+    }
+    r = (const char *) memchr(p, c, end - p);
+    return (r ? r : end);
+}
+
+#define DEFINE_GENERIC_MAX(T, name)             \
+static T                                        \
+name(const T *v, size_t n)                      \
+{                                               \
+    T m = 0;                                    \
+    size_t i;                                   \
+                                                \
+    for (i = 0; i < n; ++i) {                   \
+        m = MAX(m, v[i]);                       \
+    }                                           \
+    return (m);                                 \
+}
+
+DEFINE_GENERIC_MAX(uint16_t, generic_max_u16)
+DEFINE_GENERIC_MAX(uint32_t, generic_max_u32)
+DEFINE_GENERIC_MAX(uint64_t, generic_max_u64)
+
+static const struct mc_simd simd_generic = {
+    "generic",
+    generic_strlen,
+    generic_find_byte,
+    generic_max_u16,
+    generic_max_u32,
+    generic_max_u64,
+};
+
+#if defined(__GNUC__) && defined(__x86_64__)
+
+#include <immintrin.h>
+
+#define HAVE_X86_VARIANTS 1
+
+// ################ SSE2
+
+/*
+ * No SSE2 strlen().  16 bytes at a time was measured slower than
+ * the C library on short names; one block rarely holds a whole name,
+ * and the extra, unpredictable branch costs more than it saves.
+ */
+
+static const char *
+sse2_find_byte(const char *p, const char *end, int c)
+{
+    const __m128i needle = _mm_set1_epi8((char) c);
+
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *) p);
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if (mask != 0) {
+            return (p + __builtin_ctz(mask));
+        }
+        p += 16;
+    }
+    return (generic_find_byte(p, end, c));
+}
+
+/*
+ * SSE2 has no unsigned 16-bit or 32-bit max.
+ * Flip the sign bit, and use signed comparisons.
+ */
+
+static uint16_t
+sse2_max_u16(const uint16_t *v, size_t n)
+{
+    const __m128i bias = _mm_set1_epi16((short) 0x8000);
+    __m128i acc = _mm_set1_epi16((short) 0x8000);
+    uint16_t lane[8];
+    uint16_t m;
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (v + i)), bias);
+        acc = _mm_max_epi16(acc, x);
+    }
+    _mm_storeu_si128((__m128i *) lane, _mm_xor_si128(acc, bias));
+    m = generic_max_u16(lane, 8);
+    return (MAX(m, generic_max_u16(v + i, n - i)));
+}
+
+static uint32_t
+sse2_max_u32(const uint32_t *v, size_t n)
+{
+    const __m128i bias = _mm_set1_epi32((int) 0x80000000);
+    __m128i acc = bias;
+    uint32_t lane[4];
+    uint32_t m;
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (v + i)), bias);
+        __m128i gt = _mm_cmpgt_epi32(x, acc);
+        acc = _mm_or_si128(_mm_and_si128(gt, x), _mm_andnot_si128(gt, acc));
+    }
+    _mm_storeu_si128((__m128i *) lane, _mm_xor_si128(acc, bias));
+    m = generic_max_u32(lane, 4);
+    return (MAX(m, generic_max_u32(v + i, n - i)));
+}
+
+static const struct mc_simd simd_sse2 = {
+    "sse2",
+    generic_strlen,
+    sse2_find_byte,
+    sse2_max_u16,
+    sse2_max_u32,
+    generic_max_u64,
+};
+
+#define NO_ASAN __attribute__((no_sanitize_address))
+
+// ################ AVX2
+
+__attribute__((target("avx2"))) NO_ASAN
+static size_t
+avx2_strlen(const char *s)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const char *p = (const char *) ((uintptr_t) s & ~(uintptr_t) 31);
+    unsigned int mask;
+
+    mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *) p), zero));
+    mask >>= (s - p);
+    if (mask != 0) {
+        return (__builtin_ctz(mask));
+    }
+
+    while (true) {
+        p += 32;
+        mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256((const __m256i *) p), zero));
+        if (mask != 0) {
+            return (p + __builtin_ctz(mask) - s);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static const char *
+avx2_find_byte(const char *p, const char *end, int c)
+{
+    const __m256i needle = _mm256_set1_epi8((char) c);
+
+    while (end - p >= 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *) p);
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+        if (mask != 0) {
+            return (p + __builtin_ctz(mask));
+        }
+        p += 32;
+    }
+    return (sse2_find_byte(p, end, c));
+}
+
+__attribute__((target("avx2")))
+static uint16_t
+avx2_max_u16(const uint16_t *v, size_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    uint16_t lane[16];
+    uint16_t m;
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        acc = _mm256_max_epu16(acc, _mm256_loadu_si256((const __m256i *) (v + i)));
+    }
+    _mm256_storeu_si256((__m256i *) lane, acc);
+    m = generic_max_u16(lane, 16);
+    return (MAX(m, generic_max_u16(v + i, n - i)));
+}
+
+__attribute__((target("avx2")))
+static uint32_t
+avx2_max_u32(const uint32_t *v, size_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    uint32_t lane[8];
+    uint32_t m;
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        acc = _mm256_max_epu32(acc, _mm256_loadu_si256((const __m256i *) (v + i)));
+    }
+    _mm256_storeu_si256((__m256i *) lane, acc);
+    m = generic_max_u32(lane, 8);
+    return (MAX(m, generic_max_u32(v + i, n - i)));
+}
+
+static const struct mc_simd simd_avx2 = {
+    "avx2",
+    avx2_strlen,
+    avx2_find_byte,
+    avx2_max_u16,
+    avx2_max_u32,
+    generic_max_u64,
+};
+
+// ################ AVX-512
+
+#define AVX512_TARGET __attribute__((target("avx512f,avx512bw")))
+
+AVX512_TARGET NO_ASAN
+static size_t
+avx512_strlen(const char *s)
+{
+    const __m512i zero = _mm512_setzero_si512();
+    const char *p = (const char *) ((uintptr_t) s & ~(uintptr_t) 63);
+    uint64_t mask;
+
+    mask = _mm512_cmpeq_epi8_mask(_mm512_load_si512((const void *) p), zero);
+    mask >>= (s - p);
+    if (mask != 0) {
+        return (__builtin_ctzll(mask));
+    }
+
+    while (true) {
+        p += 64;
+        mask = _mm512_cmpeq_epi8_mask(_mm512_load_si512((const void *) p), zero);
+        if (mask != 0) {
+            return (p + __builtin_ctzll(mask) - s);
+        }
+    }
+}
+
+AVX512_TARGET
+static const char *
+avx512_find_byte(const char *p, const char *end, int c)
+{
+    const __m512i needle = _mm512_set1_epi8((char) c);
+
+    while (end - p >= 64) {
+        uint64_t mask = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void *) p), needle);
+        if (mask != 0) {
+            return (p + __builtin_ctzll(mask));
+        }
+        p += 64;
+    }
+    return (sse2_find_byte(p, end, c));
+}
+
+#define DEFINE_AVX512_MAX(T, name, lanes, vmax)                         \
+AVX512_TARGET                                                           \
+static T                                                                \
+name(const T *v, size_t n)                                              \
+{                                                                       \
+    __m512i acc = _mm512_setzero_si512();                               \
+    T lane[lanes];                                                      \
+    T m;                                                                \
+    size_t i;                                                           \
+                                                                        \
+    for (i = 0; i + lanes <= n; i += lanes) {                           \
+        acc = vmax(acc, _mm512_loadu_si512((const void *) (v + i)));    \
+    }                                                                   \
+    _mm512_storeu_si512((void *) lane, acc);                            \
+    m = generic_##name##_tail(lane, lanes);                             \
+    return (MAX(m, generic_##name##_tail(v + i, n - i)));               \
+}
+
+#define generic_avx512_max_u16_tail generic_max_u16
+#define generic_avx512_max_u32_tail generic_max_u32
+#define generic_avx512_max_u64_tail generic_max_u64
+
+DEFINE_AVX512_MAX(uint16_t, avx512_max_u16, 32, _mm512_max_epu16)
+DEFINE_AVX512_MAX(uint32_t, avx512_max_u32, 16, _mm512_max_epu32)
+DEFINE_AVX512_MAX(uint64_t, avx512_max_u64,  8, _mm512_max_epu64)
+
+static const struct mc_simd simd_avx512 = {
+    "avx512",
+    avx512_strlen,
+    avx512_find_byte,
+    avx512_max_u16,
+    avx512_max_u32,
+    avx512_max_u64,
+};
+
+#endif /* __GNUC__ && __x86_64__ */
+
+const struct mc_simd *mc_simd = NULL;
+
+static pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Pick the variant to use.
+ * Variants are listed best first.
+ */
+
+static void
+simd_select_once(void)
+{
+    const struct mc_simd *variants[4];
+    const char *force;
+    size_t nvariants;
+    size_t i;
+
+    nvariants = 0;
+#ifdef HAVE_X86_VARIANTS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        variants[nvariants++] = &simd_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        variants[nvariants++] = &simd_avx2;
+    }
+    variants[nvariants++] = &simd_sse2;
+#endif
+    variants[nvariants++] = &simd_generic;
+
+    mc_simd = variants[0];
+    force = getenv("MC_SIMD");
+    if (force != NULL) {
+        for (i = 0; i < nvariants; ++i) {
+            if (strcmp(force, variants[i]->name) == 0) {
+                mc_simd = variants[i];
+                break;
+            }
+        }
+    }
+}
+
+void
+mc_simd_select(void)
+{
+    pthread_once(&simd_once, simd_select_once);
+}
+
+/*
+ * Name of the variant in use, for reporting.
+ */
+
+const char *
+mc_simd_variant(void)
+{
+    mc_simd_select();
+    return (mc_simd->name);
+}
+
+/*
+ * Address of the first |c| in [p, end), or |end| if there is none.
+ * Used by readers to find the end of each line.
+ */
+
+const char *
+mc_find_byte(const char *p, const char *end, int c)
+{
+    mc_simd_select();
+    return (mc_simd->find_byte(p, end, c));
+}
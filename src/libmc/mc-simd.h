@@ -0,0 +1,58 @@
+/*
+ * Filename: src/libmc/mc-simd.h
+ * Project: libmc
+ * Brief: Private interface to the vectorized kernels of libmc
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MC_SIMD_H
+#define _MC_SIMD_H
+
+#include <stdint.h>
+#include <sys/types.h>      // Import size_t
+
+/*
+ * One set of kernels, built for one instruction set.
+ *
+ * strlen:
+ *     Length of a nul-terminated string.
+ *
+ * find_byte:
+ *     Address of the first byte equal to |c| in [p, end),
+ *     or |end| if there is none.
+ *
+ * max_u16, max_u32, max_u64:
+ *     Largest of |n| lengths.  0 if |n| is 0.
+ *     This is the per-column maximum of a vertical layout,
+ *     where each column is a contiguous run of lengths.
+ */
+
+struct mc_simd {
+    const char *name;
+    size_t   (*strlen)(const char *s);
+    const char *(*find_byte)(const char *p, const char *end, int c);
+    uint16_t (*max_u16)(const uint16_t *v, size_t n);
+    uint32_t (*max_u32)(const uint32_t *v, size_t n);
+    uint64_t (*max_u64)(const uint64_t *v, size_t n);
+};
+
+extern const struct mc_simd *mc_simd;
+
+extern void mc_simd_select(void);
+
+#endif  /* _MC_SIMD_H */
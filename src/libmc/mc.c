@@ -20,29 +20,87 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <errno.h>
+    // Import var errno
+    // Import constant EINTR
+    // Import constant EINVAL
+    // Import constant EIO
+    // Import constant ENOSYS
+    // Import constant ERANGE
+#include <fcntl.h>
+    // Import constant SPLICE_F_GIFT
+    // Import vmsplice()
+#include <limits.h>
+    // Import constant IOV_MAX
+#include <pthread.h>
+    // Import type pthread_barrier_t
+    // Import type pthread_cond_t
+    // Import type pthread_mutex_t
+    // Import type pthread_t
+    // Import pthread_barrier_wait()
+    // Import pthread_cond_wait()
+    // Import pthread_create()
+    // Import pthread_join()
 #include <stdbool.h>
     // Import type bool
     // Import constant false
     // Import constant true
+#include <stdint.h>
+    // Import type uint16_t
+    // Import type uint32_t
+    // Import type uint64_t
+    // Import constant UINT16_MAX
+    // Import constant UINT32_MAX
+    // Import constant SIZE_MAX
 #include <stdio.h>
     // Import type FILE
     // Import fprintf()
     // Import fputc()
+    // Import fwrite()
     // Import printf()
     // Import putchar()
+    // Import snprintf()
     // Import var stderr
 #include <stdlib.h>
+    // Import calloc()
     // Import exit()
+    // Import free()
     // Import malloc()
+    // Import qsort()
     // Import realloc()
 #include <string.h>
+    // Import memcpy()
+    // Import memset()
     // Import strlen()
+#include <sys/mman.h>
+    // Import mmap()
+    // Import munmap()
+#include <sys/stat.h>
+    // Import type struct stat
+    // Import fstat()
+    // Import S_ISFIFO()
+#include <sys/uio.h>
+    // Import type struct iovec
+    // Import writev()
 #include <unistd.h>
+    // Import sysconf()
+    // Import write()
     // Import type size_t
 
+#include <libmc.h>
+#include "mc-simd.h"
+#include "mc-private.h"
+
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
+#define MC_CAT_(a, b) a ## _ ## b
+#define MC_CAT(a, b)  MC_CAT_(a, b)
+
 /*
  * The heart of the program logic to calculate how many columns can
  * fit and the width of each column is lifted from the GNU coreutils
@@ -92,6 +150,53 @@
  * max_idx:
  *     Maximum number of columns ever possible for this display.
  *
+ * engine:
+ *     Which layout engine calculate_columns() uses.
+ *
+ * cell_bits:
+ *     Width, in bits, of the integers used for |lenv| and for the
+ *     cells of |column_info|: 16, 32 or 64.  See choose_cell_bits().
+ *
+ * len_cap:
+ *     Lengths are stored clamped to |len_cap|.
+ *
+ * lenv:
+ *     Length of each element, measured once, up front.
+ *
+ * max_len:
+ *     Length of the longest element.
+ *
+ * valid:
+ *     Bitmask of candidates that still fit.  Bit i is for i + 1 columns.
+ *
+ * live:
+ *     Scratch list of candidates still being considered,
+ *     used by the pruning engine.
+ *
+ * widths:
+ *     Width of each column of the chosen layout.
+ *
+ * stable:
+ *     Widths kept by the caller across calls.  See choose_columns().
+ *
+ * cache, cache_hit:
+ *     Lengths and layout kept by the caller across calls, and whether
+ *     they are those of the current elements.  See cache_matches().
+ *
+ * packed, marks:
+ *     If packed is not NULL, the elements are stored back to back,
+ *     from packed, and elemv is not used.  marks[i] is the offset of
+ *     element i * PACKED_MARK_EVERY.  See elem_addr().
+ *
+ * auto_cols:
+ *     With auto orientation, the number of columns already chosen,
+ *     with their widths in |widths|; otherwise 0.
+ *     See choose_orientation().
+ *
+ * uniform:
+ *     Make every column as wide as the longest element.
+ *     See uniform_columns().
+ *
  */
 
 struct mc_s {
@@ -101,9 +206,29 @@ struct mc_s {
     size_t indent;
     FILE *f;
 
-    struct column_info *column_info;
+    void *column_info;
     size_t column_info_alloc;
     size_t max_idx;
+
+    enum mc_engine engine;
+    unsigned int cell_bits;
+    size_t len_cap;
+    void *lenv;
+    size_t max_len;
+    uint64_t *valid;
+    void *live;
+    size_t *widths;
+    unsigned int threads;
+    const size_t *lengths;
+    size_t max_rows;
+    bool trailer;
+    struct mc_widths *stable;
+    struct mc_cache *cache;
+    bool cache_hit;
+    const char *packed;
+    size_t *marks;
+    size_t auto_cols;
+    bool uniform;
 };
 
 typedef struct mc_s mc_t;
@@ -132,263 +257,2042 @@ xalloc_die(void)
     exit(64);
 }
 
-static void init_column_info(mc_t *mc);
-static size_t calculate_columns(mc_t *mc, bool by_columns);
+static int print_rows(mc_t *mc, bool by_columns);
 
-static void print_many_per_line(mc_t *mc);
-static void print_horizontal(mc_t *mc);
+/*
+ * Number of element lengths examined by the sampling engine.
+ */
+#define SAMPLE_SIZE 4096
 
 /*
- * The minimum width of a column is 3:
- *     1 character for the name, and
- *     2 for the separating white space.
+ * Number of candidates evaluated together by the sampling engine.
  */
-#define MIN_COLUMN_WIDTH 3
+#define SAMPLE_WINDOW 2
 
-/* Information about filling a column.  */
+/*
+ * The validity of each candidate is one bit in mc->valid.
+ */
 
-struct column_info {
-    bool valid_len;
-    size_t line_len;
-    size_t *col_arr;
-};
+static void
+init_valid(mc_t *mc, size_t max_cols)
+{
+    size_t nwords = (max_cols + 63) / 64;
+    size_t w;
+
+    if (mc->valid == NULL) {
+        mc->valid = (uint64_t *) xnmalloc((mc->max_idx + 63) / 64, sizeof (*mc->valid));
+        if (mc->valid == NULL) {
+            xalloc_die();
+        }
+    }
+
+    for (w = 0; w < nwords; ++w) {
+        mc->valid[w] = ~(uint64_t) 0;
+    }
+}
 
+static inline bool
+valid_test(const mc_t *mc, size_t i)
+{
+    return ((mc->valid[i / 64] >> (i % 64)) & 1);
+}
+
+static inline void
+valid_clear(mc_t *mc, size_t i)
+{
+    mc->valid[i / 64] &= ~((uint64_t) 1 << (i % 64));
+}
 
 /*
- * Allocate enough column info suitable for the current number of
- * elements and display columns, and initialize the info to represent the
- * narrowest possible columns.
+ * Lower bound on the final line length of a layout with |cols| columns.
+ *
+ * Each column holds at most |rows| = ceil(nelem / cols) elements,
+ * in either orientation.  So, with lengths sorted in decreasing order,
+ * L[1] >= L[2] >= ..., the m-th widest column must contain an element
+ * at least as long as L[(m - 1) * rows + 1].  Every column but the last
+ * also carries 2 spaces of separation, and no column is narrower
+ * than MIN_COLUMN_WIDTH.
+ *
+ * |hist| is a histogram of element lengths, with all lengths
+ * greater than |cap| counted in hist[cap].
+ *
+ * We stop as soon as the bound reaches |limit|;
+ * there is no point in getting any more precise than that.
  */
 
-static void
-init_column_info(mc_t *mc)
+static size_t
+line_len_lower_bound(const mc_t *mc, const size_t *hist, size_t cap,
+    size_t cols, size_t limit)
 {
-  size_t i;
-  size_t max_cols;
+    size_t rows = (mc->nelem + cols - 1) / cols;
+    size_t len = cap;
+    size_t seen = hist[cap];    /* Elements with length >= len */
+    size_t lb = 0;
+    size_t m;
 
-  max_cols = MIN(mc->max_idx, mc->nelem);
-  if (mc->column_info_alloc < max_cols) {
-      size_t new_column_info_alloc;
-      size_t *p;
+    for (m = 0; m < cols; ++m) {
+        size_t k = m * rows + 1;
+        size_t kth_len = 0;
 
-      if (max_cols < mc->max_idx / 2) {
-          /*
-           * The number of columns is far less than the display width allows.
-           * Grow the allocation, but only so that it's double the current
-           * requirements.  If the display is extremely wide, this avoids
-           * allocating a lot of memory that is never needed.
-           */
-          mc->column_info = (struct column_info *) xnrealloc(mc->column_info, max_cols, 2 * sizeof (*mc->column_info));
-          new_column_info_alloc = 2 * max_cols;
+        if (k <= mc->nelem) {
+            while (seen < k) {
+                --len;
+                seen += hist[len];
+            }
+            kth_len = len;
         }
-      else {
-          mc->column_info = (struct column_info *) xnrealloc (mc->column_info, mc->max_idx, sizeof (*mc->column_info));
-          new_column_info_alloc = mc->max_idx;
+        lb += MAX(MIN_COLUMN_WIDTH, kth_len + 2);
+        if (lb >= limit + 2) {
+            break;
         }
+    }
 
-      /*
-       * Allocate the new size_t objects by computing the triangle
-       * formula n * (n + 1) / 2, except that we don't need to
-       * allocate the part of the triangle that we've already
-       * allocated.  Check for address arithmetic overflow.
-       */
+    return (lb - 2);
+}
 
-      {
-        size_t column_info_growth = new_column_info_alloc - mc->column_info_alloc;
-        size_t s = mc->column_info_alloc + 1 + new_column_info_alloc;
-        size_t t = s * column_info_growth;
-        if (s < new_column_info_alloc || t / column_info_growth != s)
-          xalloc_die ();
-        p = (size_t *) xnmalloc(t / 2, sizeof (*p));
-      }
+static int
+cmp_len_decreasing(const void *a, const void *b)
+{
+    size_t la = *(const size_t *) a;
+    size_t lb = *(const size_t *) b;
 
-      /* Grow the triangle by parceling out the cells just allocated.  */
-      for (i = mc->column_info_alloc; i < new_column_info_alloc; ++i) {
-          mc->column_info[i].col_arr = p;
-          p += i + 1;
-        }
+    return ((la < lb) - (la > lb));
+}
 
-      mc->column_info_alloc = new_column_info_alloc;
-    }
+/*
+ * Layout kernels.
+ *
+ * The kernels are generated once for each orientation, so that the
+ * choice between vertical and horizontal is made once per scan,
+ * rather than once per element per candidate.  Column indices are
+ * tracked with counters, so no division or modulo is done per element.
+ *
+ * Vertical:
+ *     An element goes in the same column as the one before it,
+ *     until |rows| elements have gone into that column.
+ *
+ * Horizontal:
+ *     Each element goes in the next column, wrapping around
+ *     after the last column.
+ *
+ * DEFINE_LAYOUT_KERNELS() is expanded inside mc-engine.h,
+ * so there is one set of kernels for each orientation and cell width.
+ *
+ * scan_live_*():
+ *     Scan all elements, updating only the candidates in mc->live.
+ *     Candidates that overflow are removed from the list, so they cost
+ *     nothing in the inner loop.  Once no candidate is left, stop.
+ *
+ * scan_window_*():
+ *     Evaluate a fixed-size window of SAMPLE_WINDOW candidates,
+ *     of which the first |nw| are real, in a single pass.
+ *     The loop over the window has a constant trip count.
+ */
 
-  for (i = 0; i < max_cols; ++i) {
-      size_t j;
+#define NEXT_VERTICAL(cd)                       \
+    do {                                        \
+        if (++(cd)->row == (cd)->rows) {        \
+            (cd)->row = 0;                      \
+            ++(cd)->idx;                        \
+        }                                       \
+    } while (0)
 
-      mc->column_info[i].valid_len = true;
-      mc->column_info[i].line_len = (i + 1) * MIN_COLUMN_WIDTH;
-      for (j = 0; j <= i; ++j) {
-        mc->column_info[i].col_arr[j] = MIN_COLUMN_WIDTH;
-      }
-    }
+#define NEXT_HORIZONTAL(cd)                     \
+    do {                                        \
+        if (++(cd)->idx > (cd)->last) {         \
+            (cd)->idx = 0;                      \
+        }                                       \
+    } while (0)
+
+#define DEFINE_LAYOUT_KERNELS(orient, NEXT)                             \
+                                                                        \
+static void                                                             \
+T_(scan_live_##orient)(mc_t *mc, size_t nlive, size_t limit)            \
+{                                                                       \
+    struct T_(cand) *live = (struct T_(cand) *) mc->live;               \
+    const CELL_T *lenv = (const CELL_T *) mc->lenv;                     \
+    size_t enr;                                                         \
+                                                                        \
+    for (enr = 0; enr < mc->nelem && nlive != 0; ++enr) {               \
+        size_t elem_length = lenv[enr];                                 \
+        size_t k;                                                       \
+                                                                        \
+        k = 0;                                                          \
+        while (k < nlive) {                                             \
+            if (T_(cand_add)(mc, &live[k], elem_length, limit)) {       \
+                live[k] = live[--nlive];                                \
+                continue;                                               \
+            }                                                           \
+            NEXT(&live[k]);                                             \
+            ++k;                                                        \
+        }                                                               \
+    }                                                                   \
+}                                                                       \
+                                                                        \
+static void                                                             \
+T_(scan_window_##orient)(mc_t *mc, struct T_(cand) *win, size_t nw,     \
+    size_t limit)                                                       \
+{                                                                       \
+    const CELL_T *lenv = (const CELL_T *) mc->lenv;                     \
+    bool alive[SAMPLE_WINDOW];                                          \
+    size_t nlive;                                                       \
+    size_t enr;                                                         \
+    size_t k;                                                           \
+                                                                        \
+    for (k = 0; k < SAMPLE_WINDOW; ++k) {                               \
+        alive[k] = (k < nw);                                            \
+    }                                                                   \
+                                                                        \
+    nlive = nw;                                                         \
+    for (enr = 0; enr < mc->nelem && nlive != 0; ++enr) {               \
+        size_t elem_length = lenv[enr];                                 \
+                                                                        \
+        for (k = 0; k < SAMPLE_WINDOW; ++k) {                           \
+            if (alive[k]) {                                             \
+                if (T_(cand_add)(mc, &win[k], elem_length, limit)) {    \
+                    alive[k] = false;                                   \
+                    --nlive;                                            \
+                }                                                       \
+                else {                                                  \
+                    NEXT(&win[k]);                                      \
+                }                                                       \
+            }                                                           \
+        }                                                               \
+    }                                                                   \
+}
+
+/*
+ * Range maximum of lengths, for each cell width,
+ * using whichever vectorized kernels mc_simd_select() chose.
+ */
+
+static inline size_t
+simd_max_16(const uint16_t *v, size_t n)
+{
+    return (mc_simd->max_u16(v, n));
+}
+
+static inline size_t
+simd_max_32(const uint32_t *v, size_t n)
+{
+    return (mc_simd->max_u32(v, n));
+}
+
+static inline size_t
+simd_max_64(const uint64_t *v, size_t n)
+{
+    return (mc_simd->max_u64(v, n));
 }
 
+static size_t elem_length(const mc_t *mc, size_t enr);
+
+#define CELL_T    uint16_t
+#define CELL_BITS 16
+#include "mc-engine.h"
+
+#define CELL_T    uint32_t
+#define CELL_BITS 32
+#include "mc-engine.h"
+
+#define CELL_T    uint64_t
+#define CELL_BITS 64
+#include "mc-engine.h"
 
 /*
- * Calculate the number of columns needed to represent
- * the current set of elements in the current display width.
+ * Choose the narrowest integer type that can hold element lengths
+ * and column_info cells, for this display width.
+ *
+ * An element longer than |limit| + MIN_COLUMN_WIDTH overflows every
+ * candidate that it is added to, whatever its exact length: its
+ * column alone makes the line too long, and wider than the minimum,
+ * even when |limit| is 0.  So lengths are clamped to
+ * limit + MIN_COLUMN_WIDTH + 1, and a single huge element does not
+ * force wide cells.  A cell is at most a clamped length plus 2, and
+ * a line length stops growing once it reaches |limit|, so nothing
+ * gets bigger than |limit| plus two cells, or the initial line
+ * length, which is at most |llen|.
+ *
+ * |min_bits| comes from mc_opt_t; it can make cells wider, never narrower.
+ *
+ * Narrow cells mean less cache traffic in the inner loops;
+ * at 16 bits, the column_info triangle for a 1000-column display
+ * takes about 330KB less than it would at 64 bits.
  */
 
+static void
+choose_cell_bits(mc_t *mc, unsigned int min_bits)
+{
+    size_t limit = mc->llen - mc->indent;
+    size_t largest;
+
+    if (limit > SIZE_MAX / 4) {
+        mc->len_cap = SIZE_MAX - 2;
+        mc->cell_bits = 64;
+        return;
+    }
+
+    mc->len_cap = limit + MIN_COLUMN_WIDTH + 1;
+    largest = MAX(mc->llen, limit + 2 * (mc->len_cap + 2));
+    if (largest <= UINT16_MAX && min_bits <= 16) {
+        mc->cell_bits = 16;
+    }
+    else if (largest <= UINT32_MAX && min_bits <= 32) {
+        mc->cell_bits = 32;
+    }
+    else {
+        mc->cell_bits = 64;
+    }
+}
+
+static void
+measure_elements(mc_t *mc)
+{
+    switch (mc->cell_bits) {
+    case 16:
+        measure_elements_16(mc);
+        break;
+    case 32:
+        measure_elements_32(mc);
+        break;
+    default:
+        measure_elements_64(mc);
+        break;
+    }
+}
+
 static size_t
 calculate_columns(mc_t *mc, bool by_columns)
 {
-    size_t enr;      /* Index into elements.  */
-    size_t cols;     /* Number of elements across.  */
+    switch (mc->cell_bits) {
+    case 16:
+        return (calculate_columns_16(mc, by_columns));
+    case 32:
+        return (calculate_columns_32(mc, by_columns));
+    default:
+        return (calculate_columns_64(mc, by_columns));
+    }
+}
 
-    /*
-     * Normally the maximum number of columns is determined by the screen width.
-     * But if few files are available this might limit it as well.
-     */
-    size_t max_cols = MIN(mc->max_idx, mc->nelem);
+static void
+calculate_plans(mc_t *mc, bool by_columns, size_t nplans, struct mc_plan **plans)
+{
+    switch (mc->cell_bits) {
+    case 16:
+        calculate_plans_16(mc, by_columns, nplans, plans);
+        break;
+    case 32:
+        calculate_plans_32(mc, by_columns, nplans, plans);
+        break;
+    default:
+        calculate_plans_64(mc, by_columns, nplans, plans);
+        break;
+    }
+}
 
-    init_column_info(mc);
+static bool
+calculate_auto(mc_t *mc, size_t *colsp)
+{
+    switch (mc->cell_bits) {
+    case 16:
+        return (calculate_auto_16(mc, colsp));
+    case 32:
+        return (calculate_auto_32(mc, colsp));
+    default:
+        return (calculate_auto_64(mc, colsp));
+    }
+}
 
-    /* Compute the maximum number of possible columns.  */
-    for (enr = 0; enr < mc->nelem; ++enr) {
-        const char *elem = mc->elemv[enr];
-        size_t elem_length = strlen(elem);
-        size_t i;
-
-        for (i = 0; i < max_cols; ++i) {
-            if (mc->column_info[i].valid_len) {
-                size_t idx = (by_columns
-                ? enr / ((mc->nelem + i) / (i + 1))
-                : enr % (i + 1));
-                size_t real_length = elem_length + (idx == i ? 0 : 2);
-
-                if (mc->column_info[i].col_arr[idx] < real_length) {
-                    mc->column_info[i].line_len += (real_length
-                    - mc->column_info[i].col_arr[idx]);
-                    mc->column_info[i].col_arr[idx] = real_length;
-                    mc->column_info[i].valid_len = (mc->column_info[i].line_len < mc->llen - mc->indent);
-                }
-            }
-        }
+static void
+calculate_rows(mc_t *mc, bool by_columns, size_t max_rows, struct mc_plan *plan)
+{
+    switch (mc->cell_bits) {
+    case 16:
+        calculate_rows_16(mc, by_columns, max_rows, plan);
+        break;
+    case 32:
+        calculate_rows_32(mc, by_columns, max_rows, plan);
+        break;
+    default:
+        calculate_rows_64(mc, by_columns, max_rows, plan);
+        break;
     }
+}
 
-    /* Find maximum allowed columns. */
-    for (cols = max_cols; 1 < cols; --cols) {
-        if (mc->column_info[cols - 1].valid_len) {
-            break;
-        }
+static size_t
+calculate_breakpoints(mc_t *mc, bool by_columns, struct mc_plan *table)
+{
+    switch (mc->cell_bits) {
+    case 16:
+        return (calculate_breakpoints_16(mc, by_columns, table));
+    case 32:
+        return (calculate_breakpoints_32(mc, by_columns, table));
+    default:
+        return (calculate_breakpoints_64(mc, by_columns, table));
     }
+}
 
-    return (cols);
+static bool
+calculate_fit(mc_t *mc, bool by_columns, size_t max_rows, struct mc_plan *plan)
+{
+    switch (mc->cell_bits) {
+    case 16:
+        return (calculate_fit_16(mc, by_columns, max_rows, plan));
+    case 32:
+        return (calculate_fit_32(mc, by_columns, max_rows, plan));
+    default:
+        return (calculate_fit_64(mc, by_columns, max_rows, plan));
+    }
 }
 
-static void
-print_many_per_line(mc_t *mc)
+/*
+ * Exact length of element |enr|.
+ * Only lengths that were clamped need to be measured again.
+ */
+
+static size_t
+elem_length(const mc_t *mc, size_t enr)
 {
-    size_t row;    /* Current row.  */
-    size_t cols = calculate_columns(mc, true);
-    struct column_info const *line_fmt = &mc->column_info[cols - 1];
+    size_t len;
 
-    /* Calculate the number of rows that will be in each column,
-     * except possibly for a short column on the right.
-     */
-    size_t rows = mc->nelem / cols + (mc->nelem % cols != 0);
+    switch (mc->cell_bits) {
+    case 16:
+        len = ((const uint16_t *) mc->lenv)[enr];
+        break;
+    case 32:
+        len = ((const uint32_t *) mc->lenv)[enr];
+        break;
+    default:
+        len = ((const uint64_t *) mc->lenv)[enr];
+        break;
+    }
 
-#if 0
-    printf("cols=%zu\n", cols);
-    printf("\n");
-#endif
+    if (len >= mc->len_cap) {
+        len = mc->lengths ? mc->lengths[enr] : strlen(mc->elemv[enr]);
+    }
+    return (len);
+}
 
-    for (row = 0; row < rows; ++row) {
-        size_t col = 0;
-        size_t enr = row;
+/*
+ * Can the widths kept in mc->stable, from an earlier layout, be used
+ * again for the current elements, with the same number of columns?
+ * Only if the line still fits and every element fits its column,
+ * with room for the separating white space, except in the last column.
+ */
 
-        /* Print the next row. */
-        while (true) {
-            const char *elem = mc->elemv[enr];
-            size_t elem_length = strlen(elem);
-            size_t max_elem_length = line_fmt->col_arr[col];
+static bool
+stable_fits(mc_t *mc, bool by_columns)
+{
+    const struct mc_widths *stable = mc->stable;
+    size_t cols = stable->cols;
+    size_t rows;
+    size_t line_len;
+    size_t col;
+    size_t enr;
 
-            if (col == 0) {
-                size_t i;
+    if (cols == 0 || cols > mc->max_idx) {
+        return (false);
+    }
+    line_len = 0;
+    for (col = 0; col < cols; ++col) {
+        line_len += stable->widths[col];
+    }
+    if (cols > 1 && line_len >= mc->llen - MIN(mc->indent, mc->llen)) {
+        return (false);
+    }
 
-                for (i = 0; i < mc->indent; ++i) {
-                    fputc(' ', mc->f);
-                }
-            }
+    rows = mc->nelem / cols + (mc->nelem % cols != 0);
+    for (enr = 0; enr < mc->nelem; ++enr) {
+        size_t len = elem_length(mc, enr);
 
-            fprintf(mc->f, "%s", elem);
-            if (col < cols - 1) {
-                size_t len;
-                for (len = elem_length; len < max_elem_length; ++len) {
-                    fputc(' ', mc->f);
-                }
-            }
+        col = by_columns ? enr / rows : enr % cols;
+        if (len + (col == cols - 1 ? 0 : 2) > stable->widths[col]) {
+            return (false);
+        }
+    }
+    return (true);
+}
 
-            enr += rows;
-            if (enr >= mc->nelem) {
-                break;
-            }
+/*
+ * Is the layout kept in mc->cache that of a list just like the
+ * current one?  Only the lengths of the elements, their number and
+ * the orientation wanted count, so if they are the same, so is the
+ * layout, and it takes no layout pass to find it.
+ */
 
-            ++col;
+static bool
+cache_matches(const mc_t *mc, const mc_opt_t *opt)
+{
+    const struct mc_cache *cache = mc->cache;
+    size_t enr;
+
+    if (cache->nelem != mc->nelem || cache->widths.cols == 0) {
+        return (false);
+    }
+    if (!opt->auto_orientation && cache->by_columns == opt->horizontal) {
+        return (false);
+    }
+    for (enr = 0; enr < mc->nelem; ++enr) {
+        if (elem_length(mc, enr) != cache->lengths[enr]) {
+            return (false);
         }
-        fputc('\n', mc->f);
     }
+    return (true);
 }
 
+/*
+ * Keep the lengths of the current elements, and the layout chosen
+ * for them, in mc->cache.
+ */
+
 static void
-print_horizontal(mc_t *mc)
+cache_keep(mc_t *mc, bool by_columns, size_t cols)
 {
+    struct mc_cache *cache = mc->cache;
     size_t enr;
-    size_t cols = calculate_columns(mc, false);
-    struct column_info const *line_fmt = &mc->column_info[cols - 1];
 
+    if (cache->alloc < mc->nelem) {
+        free(cache->lengths);
+        cache->lengths = (size_t *) xnmalloc(mc->nelem, sizeof (*cache->lengths));
+        if (cache->lengths == NULL) {
+            xalloc_die();
+        }
+        cache->alloc = mc->nelem;
+    }
     for (enr = 0; enr < mc->nelem; ++enr) {
-        const char *elem = mc->elemv[enr];
-        size_t elem_length = strlen(elem);
-        size_t max_elem_length;
-        size_t col = enr % cols;
-
-        max_elem_length = line_fmt->col_arr[col];
-        if (col == 0) {
-            size_t i;
+        cache->lengths[enr] = elem_length(mc, enr);
+    }
+    cache->nelem = mc->nelem;
+    cache->by_columns = by_columns;
 
-            if (enr != 0) {
-                fputc('\n', mc->f);
-            }
-            for (i = 0; i < mc->indent; ++i) {
-                fputc(' ', mc->f);
-            }
+    if (cache->widths.alloc < cols) {
+        cache->widths.widths = (size_t *) xnrealloc(cache->widths.widths, cols, sizeof (*cache->widths.widths));
+        if (cache->widths.widths == NULL) {
+            xalloc_die();
         }
+        cache->widths.alloc = cols;
+    }
+    memcpy(cache->widths.widths, mc->widths, cols * sizeof (*mc->widths));
+    cache->widths.cols = cols;
+}
+
+/*
+ * Columns all of the same width, that of the longest element plus
+ * the two spaces between columns, as many as fit in the line.
+ * The longest element is known from measure_elements(), so this
+ * takes no pass over the lengths, and there is no candidate search.
+ * Columns are counted as in mc_grid_init(): the last column needs
+ * no spaces after it.
+ */
+
+static size_t
+uniform_columns(mc_t *mc)
+{
+    size_t limit = mc->llen > mc->indent ? mc->llen - mc->indent : 0;
+    size_t width = MAX(mc->max_len + 2, MIN_COLUMN_WIDTH);
+    size_t cols;
+    size_t col;
+
+    cols = (limit + 2) / width;
+    cols = MIN(cols, MIN(mc->max_idx, mc->nelem));
+    cols = MAX(cols, 1);
+    for (col = 0; col + 1 < cols; ++col) {
+        mc->widths[col] = width;
+    }
+    mc->widths[cols - 1] = MAX(mc->max_len, MIN_COLUMN_WIDTH);
+    return (cols);
+}
+
+/*
+ * Choose the number of columns, and leave their widths in mc->widths.
+ * If the caller keeps a layout for the same elements, use it.
+ * If the caller keeps widths from one call to the next, prefer
+ * the kept widths, if they still fit, and keep what was chosen.
+ */
+
+static size_t
+choose_columns(mc_t *mc, bool by_columns)
+{
+    struct mc_widths *stable = mc->stable;
+    size_t cols;
+
+    if (mc->cache_hit) {
+        cols = mc->cache->widths.cols;
+        memcpy(mc->widths, mc->cache->widths.widths, cols * sizeof (*mc->widths));
+        return (cols);
+    }
+    if (stable != NULL && stable_fits(mc, by_columns)) {
+        memcpy(mc->widths, stable->widths, stable->cols * sizeof (*mc->widths));
+        return (stable->cols);
+    }
 
-        fprintf(mc->f, "%s", elem);
-        if (col < cols - 1) {
-            size_t len;
-            for (len = elem_length; len < max_elem_length; ++len) {
-                fputc(' ', mc->f);
+    if (mc->uniform) {
+        cols = uniform_columns(mc);
+    }
+    else if (mc->auto_cols != 0) {
+        cols = mc->auto_cols;
+    }
+    else {
+        cols = calculate_columns(mc, by_columns);
+    }
+    if (stable != NULL) {
+        if (stable->alloc < cols) {
+            stable->widths = (size_t *) xnrealloc(stable->widths, cols, sizeof (*stable->widths));
+            if (stable->widths == NULL) {
+                xalloc_die();
             }
+            stable->alloc = cols;
         }
+        memcpy(stable->widths, mc->widths, cols * sizeof (*mc->widths));
+        stable->cols = cols;
+    }
+    else if (mc->cache != NULL) {
+        cache_keep(mc, by_columns, cols);
+    }
+    return (cols);
+}
+
+/*
+ * Decide whether to lay out by columns.  With auto orientation,
+ * that takes laying out both ways, so the layout chosen is kept,
+ * in mc->auto_cols and mc->widths, for choose_columns().
+ */
+
+static bool
+choose_orientation(mc_t *mc, const mc_opt_t *opt)
+{
+    if (mc->cache_hit) {
+        return (mc->cache->by_columns);
+    }
+    if (!opt->auto_orientation || opt->uniform) {
+        return (!opt->horizontal);
+    }
+    return (calculate_auto(mc, &mc->auto_cols));
+}
+
+/*
+ * Printing, a tile of rows at a time.
+ *
+ * In a vertical layout, row |row| holds elements row, row + rows,
+ * row + 2 * rows, ... so printing row by row strides through elemv,
+ * and through the strings it points to, which for a huge list is
+ * a cache miss and a TLB miss for nearly every element.
+ *
+ * Instead, a tile of consecutive rows is first gathered, one column
+ * at a time, into a small staging block of element pointers and
+ * lengths.  Each column of a tile is a contiguous run of elemv and
+ * lenv, so the gather reads memory sequentially, and it prefetches
+ * the strings as it goes.  Then the rows of the tile are rendered
+ * from the staging block into an output buffer, with memcpy()
+ * and memset(), and the buffer is written with a single fwrite().
+ *
+ * Horizontal layouts go through the same tiles; for them,
+ * the gather is cheap, since rows are already contiguous.
+ *
+ * PRINT_TILE_ELEMS bounds the number of elements in a tile,
+ * so that the strings of a tile still fit comfortably in cache
+ * by the time they are copied.
+ */
+
+#define PRINT_TILE_ELEMS 1024
+
+struct mc_buf {
+    char *p;
+    size_t siz;
+    size_t len;
+};
+
+struct mc_tile {
+    bool by_columns;
+    size_t rows;
+    size_t cols;
+    size_t stride;      /* Slots per column; most rows in a tile */
+    size_t nrows;       /* Rows in this tile */
+    const char **elem;  /* elem[col * stride + r], NULL for no element */
+    size_t *len;        /* len[col * stride + r] */
+    struct mc_buf *out; /* Rendered rows are appended here */
+};
+
+static void
+tile_init(struct mc_tile *tile, bool by_columns, size_t rows, size_t cols)
+{
+    tile->by_columns = by_columns;
+    tile->rows = rows;
+    tile->cols = cols;
+    tile->stride = MAX(1, PRINT_TILE_ELEMS / cols);
+    tile->nrows = 0;
+    tile->elem = (const char **) xnmalloc(cols * tile->stride, sizeof (*tile->elem));
+    tile->len = (size_t *) xnmalloc(cols * tile->stride, sizeof (*tile->len));
+    tile->out = NULL;
+    if (tile->elem == NULL || tile->len == NULL) {
+        xalloc_die();
     }
+}
 
-    fputc('\n', mc->f);
+static void
+tile_fini(struct mc_tile *tile)
+{
+    free(tile->elem);
+    free(tile->len);
 }
 
+/*
+ * Bytes of padding after an element of length |len| in column |col|.
+ * The last column is never padded.
+ */
 
-int
-mc(FILE *f, size_t nelem, const char **elemv, size_t llen, size_t indent, bool horizontal)
+static inline size_t
+pad_length(const mc_t *mc, size_t cols, size_t col, size_t len)
 {
-    mc_t mcbuf;
-    mc_t *mc = &mcbuf;
+    if (col == cols - 1 || mc->widths[col] <= len) {
+        return (0);
+    }
+    return (mc->widths[col] - len);
+}
 
-    mc->nelem  = nelem;
-    mc->elemv  = elemv;
-    mc->llen   = llen;
-    mc->indent = indent;
-    mc->column_info = NULL;
-    mc->column_info_alloc = 0;
-    mc->max_idx = mc->llen / MIN_COLUMN_WIDTH;
-    if (mc->max_idx < 1) {
-        mc->max_idx = 1;
+/*
+ * Packed elements.
+ *
+ * When the elements are stored back to back, as in a file they were
+ * spilled to, there is no array of pointers to them.  The address of
+ * an element is its offset, which is the sum of the lengths before it.
+ * The offset of every PACKED_MARK_EVERY'th element is kept in marks,
+ * so finding any element adds up fewer than PACKED_MARK_EVERY lengths.
+ * Elements are mostly gathered in order, so the address of the next
+ * element is remembered, and is usually what is asked for next.
+ */
+
+#define PACKED_MARK_EVERY 64
+
+struct mc_cursor {
+    size_t enr;         /* Element whose address is |addr| */
+    const char *addr;
+};
+
+static void
+init_marks(mc_t *mc)
+{
+    size_t off;
+    size_t enr;
+
+    mc->marks = (size_t *) xnmalloc(mc->nelem / PACKED_MARK_EVERY + 1, sizeof (*mc->marks));
+    if (mc->marks == NULL) {
+        xalloc_die();
     }
-    mc->f = f;
-    if (horizontal) {
-        print_horizontal(mc);
+    off = 0;
+    for (enr = 0; enr < mc->nelem; ++enr) {
+        if (enr % PACKED_MARK_EVERY == 0) {
+            mc->marks[enr / PACKED_MARK_EVERY] = off;
+        }
+        off += mc->lengths[enr];
     }
-    else {
-        print_many_per_line(mc);
+}
+
+/*
+ * Address of element |enr|, of length |len|.
+ */
+
+static inline const char *
+elem_addr(const mc_t *mc, size_t enr, size_t len, struct mc_cursor *cur)
+{
+    const char *addr;
+
+    if (mc->packed == NULL) {
+        return (mc->elemv[enr]);
     }
-    return (0);
+    if (enr == cur->enr) {
+        addr = cur->addr;
+    }
+    else {
+        size_t i = enr - enr % PACKED_MARK_EVERY;
+
+        addr = mc->packed + mc->marks[enr / PACKED_MARK_EVERY];
+        for (; i < enr; ++i) {
+            addr += mc->lengths[i];
+        }
+    }
+    cur->enr = enr + 1;
+    cur->addr = addr + len;
+    return (addr);
+}
+
+/*
+ * Gather element |enr| into slot |r| of column |col| of the tile.
+ * Return the number of bytes it takes to render it.
+ */
+
+static inline size_t
+gather_elem(mc_t *mc, struct mc_tile *tile, size_t col, size_t r, size_t enr,
+    struct mc_cursor *cur)
+{
+    size_t slot = col * tile->stride + r;
+    size_t len;
+
+    if (enr >= mc->nelem) {
+        tile->elem[slot] = NULL;
+        return (0);
+    }
+    len = elem_length(mc, enr);
+    tile->elem[slot] = elem_addr(mc, enr, len, cur);
+    __builtin_prefetch(tile->elem[slot]);
+    tile->len[slot] = len;
+    return (len + pad_length(mc, tile->cols, col, len));
+}
+
+/*
+ * Gather rows row0 .. row0 + nrows - 1.
+ * Return the number of bytes it takes to render them.
+ *
+ * Elements are visited in the order they are stored: a column at
+ * a time in a vertical layout, a row at a time in a horizontal one.
+ */
+
+static size_t
+tile_gather(mc_t *mc, struct mc_tile *tile, size_t row0, size_t nrows)
+{
+    struct mc_cursor cur = { SIZE_MAX, NULL };
+    size_t need = nrows * (mc->indent + 1);
+    size_t col;
+    size_t r;
+
+    tile->nrows = nrows;
+    if (tile->by_columns) {
+        for (col = 0; col < tile->cols; ++col) {
+            for (r = 0; r < nrows; ++r) {
+                need += gather_elem(mc, tile, col, r, col * tile->rows + row0 + r, &cur);
+            }
+        }
+    }
+    else {
+        for (r = 0; r < nrows; ++r) {
+            for (col = 0; col < tile->cols; ++col) {
+                need += gather_elem(mc, tile, col, r, (row0 + r) * tile->cols + col, &cur);
+            }
+        }
+    }
+
+    return (need);
+}
+
+/*
+ * Make room for |need| more bytes in |out|.
+ */
+
+static void
+buf_reserve(struct mc_buf *out, size_t need)
+{
+    if (out->len + need > out->siz) {
+        out->siz = MAX(out->len + need, 2 * out->siz);
+        out->p = (char *) xnrealloc(out->p, out->siz, 1);
+        if (out->p == NULL) {
+            xalloc_die();
+        }
+    }
+}
+
+/*
+ * Render the gathered rows, appending them to the output buffer.
+ * Within a row, once a column has no element, neither do the
+ * columns to its right.
+ */
+
+static void
+tile_render(mc_t *mc, struct mc_tile *tile)
+{
+    char *p = tile->out->p + tile->out->len;
+    size_t r;
+
+    for (r = 0; r < tile->nrows; ++r) {
+        size_t col;
+
+        memset(p, ' ', mc->indent);
+        p += mc->indent;
+        for (col = 0; col < tile->cols; ++col) {
+            const char *elem = tile->elem[col * tile->stride + r];
+            size_t len = tile->len[col * tile->stride + r];
+            size_t pad;
+
+            if (elem == NULL) {
+                break;
+            }
+            memcpy(p, elem, len);
+            p += len;
+            pad = pad_length(mc, tile->cols, col, len);
+            memset(p, ' ', pad);
+            p += pad;
+        }
+        *p++ = '\n';
+    }
+    tile->out->len = p - tile->out->p;
+}
+
+/*
+ * Render rows row0 .. row0 + nrows - 1, a tile at a time,
+ * appending to the output buffer.
+ */
+
+static void
+render_rows(mc_t *mc, struct mc_tile *tile, size_t row0, size_t nrows)
+{
+    size_t row;
+
+    for (row = row0; row < row0 + nrows; row += tile->stride) {
+        buf_reserve(tile->out, tile_gather(mc, tile, row, MIN(tile->stride, row0 + nrows - row)));
+        tile_render(mc, tile);
+    }
+}
+
+/*
+ * The shape of a layout, and how much of it to show.
+ *
+ * Only the first mc->max_rows rows are shown, if that is not 0.
+ * The widths are still those of the whole layout.
+ */
+
+struct mc_layout {
+    size_t cols;
+    size_t rows;
+    size_t show;        /* Rows to show */
+    size_t omitted;     /* Elements not shown */
+};
+
+static void
+layout(mc_t *mc, bool by_columns, struct mc_layout *lo)
+{
+    size_t shown;
+
+    lo->cols = choose_columns(mc, by_columns);
+
+    /* Calculate the number of rows that will be in each column,
+     * except possibly for a short column on the right.
+     */
+    lo->rows = mc->nelem / lo->cols + (mc->nelem % lo->cols != 0);
+    lo->show = lo->rows;
+    if (mc->max_rows != 0 && mc->max_rows < lo->rows) {
+        lo->show = mc->max_rows;
+    }
+
+    if (by_columns) {
+        size_t col;
+
+        shown = 0;
+        for (col = 0; col < lo->cols && col * lo->rows < mc->nelem; ++col) {
+            shown += MIN(lo->show, mc->nelem - col * lo->rows);
+        }
+    }
+    else {
+        shown = MIN(mc->nelem, lo->show * lo->cols);
+    }
+    lo->omitted = mc->nelem - shown;
+}
+
+/*
+ * Text of the trailer line, after the indentation, that says how many
+ * elements were omitted.  Return its length, 0 if there is none.
+ */
+
+static size_t
+trailer_text(const mc_t *mc, const struct mc_layout *lo, char *text, size_t siz)
+{
+    int len;
+
+    if (!mc->trailer || lo->omitted == 0) {
+        return (0);
+    }
+    len = snprintf(text, siz, "... %zu more\n", lo->omitted);
+    return (len > 0 ? (size_t) len : 0);
+}
+
+/*
+ * Append the trailer to |out|, which must have room for it.
+ */
+
+static void
+buf_trailer(const mc_t *mc, struct mc_buf *out, const char *text, size_t len)
+{
+    if (len == 0) {
+        return;
+    }
+    memset(out->p + out->len, ' ', mc->indent);
+    out->len += mc->indent;
+    memcpy(out->p + out->len, text, len);
+    out->len += len;
+}
+
+#define TRAILER_MAX 64
+
+/*
+ * Parallel rendering.
+ *
+ * Once the widths are known, every row can be rendered on its own.
+ * Rows are dealt out in rounds: in each round, each of |nthreads|
+ * threads renders the next band of PRINT_BAND_TILES tiles into its
+ * own buffer.  Thread 0, the caller, also writes the buffers of each
+ * round out, in order, while the other threads render the next round.
+ * Each thread has two buffers, used in alternate rounds, and
+ * a barrier at the end of each round keeps a thread from reusing
+ * a buffer before it has been written.
+ *
+ * If a write fails, every thread must leave on the same round, or
+ * the others wait forever at the next barrier.  So no thread reads
+ * crew->err, which thread 0 sets while the others are rendering.
+ * Instead, before the barrier of each round, thread 0 copies it to
+ * stop[round % 2], and every thread decides from that after the
+ * barrier.  Thread 0 writes that slot again only two rounds later,
+ * after the next barrier, which no thread passes before reading it.
+ *
+ * Lists smaller than PARALLEL_MIN_ELEMS are not worth the trouble.
+ */
+
+#define PRINT_BAND_TILES   16
+#define PARALLEL_MIN_ELEMS (64 * 1024)
+
+struct mc_worker;
+
+struct mc_crew {
+    mc_t *mc;
+    int err;            /* Set only by thread 0, while writing */
+    int stop[2];        /* err, as of the barrier of a round; by round % 2 */
+    size_t nthreads;
+    size_t total_rows;
+    size_t band_rows;
+    size_t nrounds;
+    pthread_barrier_t round_done;
+    pthread_mutex_t lock;
+    pthread_cond_t go;
+    bool started;
+    struct mc_worker *workers;
+};
+
+struct mc_worker {
+    struct mc_crew *crew;
+    size_t id;
+    pthread_t thread;
+    struct mc_tile tile;
+    struct mc_buf buf[2];
+};
+
+static void
+crew_write_round(struct mc_crew *crew, size_t round)
+{
+    size_t t;
+
+    for (t = 0; t < crew->nthreads; ++t) {
+        struct mc_buf *b = &crew->workers[t].buf[round % 2];
+
+        if (crew->err == 0 && fwrite(b->p, 1, b->len, crew->mc->f) != b->len) {
+            crew->err = errno ? errno : EIO;
+        }
+        b->len = 0;
+    }
+}
+
+static void
+crew_run(struct mc_worker *w)
+{
+    struct mc_crew *crew = w->crew;
+    size_t round;
+
+    for (round = 0; round < crew->nrounds; ++round) {
+        size_t band = round * crew->nthreads + w->id;
+        size_t row0 = band * crew->band_rows;
+
+        w->tile.out = &w->buf[round % 2];
+        if (row0 < crew->total_rows) {
+            size_t nrows = MIN(crew->band_rows, crew->total_rows - row0);
+            render_rows(crew->mc, &w->tile, row0, nrows);
+        }
+        if (w->id == 0) {
+            crew->stop[round % 2] = crew->err;
+        }
+        pthread_barrier_wait(&crew->round_done);
+
+        // The same value for every thread; see above
+        if (crew->stop[round % 2] != 0) {
+            break;
+        }
+        if (w->id == 0) {
+            crew_write_round(crew, round);
+        }
+    }
+}
+
+static void *
+crew_thread(void *arg)
+{
+    struct mc_worker *w = (struct mc_worker *) arg;
+    struct mc_crew *crew = w->crew;
+
+    pthread_mutex_lock(&crew->lock);
+    while (!crew->started) {
+        pthread_cond_wait(&crew->go, &crew->lock);
+    }
+    pthread_mutex_unlock(&crew->lock);
+
+    crew_run(w);
+    return (NULL);
+}
+
+/*
+ * Print with up to |nthreads| threads, including the caller.
+ * If fewer threads can be created, go on with what we got.
+ */
+
+static int
+print_rows_parallel(mc_t *mc, bool by_columns, size_t rows, size_t cols,
+    size_t show, size_t nthreads)
+{
+    struct mc_crew crew;
+    size_t created;
+    size_t t;
+
+    crew.mc = mc;
+    crew.err = 0;
+    crew.stop[0] = 0;
+    crew.stop[1] = 0;
+    crew.total_rows = show;
+    crew.started = false;
+    crew.workers = (struct mc_worker *) xnmalloc(nthreads, sizeof (*crew.workers));
+    if (crew.workers == NULL) {
+        xalloc_die();
+    }
+    pthread_mutex_init(&crew.lock, NULL);
+    pthread_cond_init(&crew.go, NULL);
+
+    for (t = 0; t < nthreads; ++t) {
+        struct mc_worker *w = &crew.workers[t];
+
+        w->crew = &crew;
+        w->id = t;
+        tile_init(&w->tile, by_columns, rows, cols);
+        memset(w->buf, 0, sizeof (w->buf));
+    }
+
+    created = 1;
+    for (t = 1; t < nthreads; ++t) {
+        if (pthread_create(&crew.workers[t].thread, NULL, crew_thread, &crew.workers[t]) != 0) {
+            break;
+        }
+        ++created;
+    }
+
+    crew.nthreads = created;
+    crew.band_rows = PRINT_BAND_TILES * crew.workers[0].tile.stride;
+    crew.nrounds = (show + crew.band_rows * created - 1) / (crew.band_rows * created);
+    pthread_barrier_init(&crew.round_done, NULL, created);
+
+    pthread_mutex_lock(&crew.lock);
+    crew.started = true;
+    pthread_cond_broadcast(&crew.go);
+    pthread_mutex_unlock(&crew.lock);
+
+    crew_run(&crew.workers[0]);
+
+    for (t = 1; t < created; ++t) {
+        pthread_join(crew.workers[t].thread, NULL);
+    }
+
+    pthread_barrier_destroy(&crew.round_done);
+    pthread_cond_destroy(&crew.go);
+    pthread_mutex_destroy(&crew.lock);
+    for (t = 0; t < nthreads; ++t) {
+        tile_fini(&crew.workers[t].tile);
+        free(crew.workers[t].buf[0].p);
+        free(crew.workers[t].buf[1].p);
+    }
+    free(crew.workers);
+    return (crew.err);
+}
+
+/*
+ * Output with writev(2).
+ *
+ * Rather than copying elements into a buffer, describe each row with
+ * iovecs: one that points at the bytes of each element, wherever the
+ * caller keeps them, and others that point into one shared, constant
+ * buffer of blanks, for indentation and padding, and at a newline.
+ * The iovecs are handed to writev() in batches of up to IOV_MAX.
+ * Nothing but the iovecs themselves is ever written by libmc, so
+ * elements that live in a file mapping go from the page cache to
+ * the output without being copied in user space.
+ */
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+const char mc_blanks[256] = {
+#define B8  ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' '
+#define B64 B8, B8, B8, B8, B8, B8, B8, B8
+    B64, B64, B64, B64
+#undef B64
+#undef B8
+};
+
+static const char newline[1] = { '\n' };
+
+struct mc_iov {
+    int fd;
+    int err;
+    size_t n;
+    struct iovec iov[IOV_MAX];
+};
+
+/*
+ * Write all batched iovecs, coping with partial writes.
+ * After the first error, nothing more is written.
+ */
+
+static void
+iov_flush(struct mc_iov *o)
+{
+    struct iovec *iov = o->iov;
+    size_t n = o->n;
+
+    while (n != 0 && o->err == 0) {
+        ssize_t rv = writev(o->fd, iov, n);
+        size_t done;
+
+        if (rv < 0) {
+            if (errno != EINTR) {
+                o->err = errno;
+            }
+            continue;
+        }
+
+        done = rv;
+        while (n != 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            ++iov;
+            --n;
+        }
+        if (n != 0) {
+            iov->iov_base = (char *) iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+    o->n = 0;
+}
+
+static inline void
+iov_add(struct mc_iov *o, const char *p, size_t len)
+{
+    if (len == 0) {
+        return;
+    }
+    if (o->n == IOV_MAX) {
+        iov_flush(o);
+    }
+    o->iov[o->n].iov_base = (void *) p;
+    o->iov[o->n].iov_len = len;
+    ++o->n;
+}
+
+static inline void
+iov_blanks(struct mc_iov *o, size_t len)
+{
+    while (len != 0) {
+        size_t k = MIN(len, sizeof (mc_blanks));
+
+        iov_add(o, mc_blanks, k);
+        len -= k;
+    }
+}
+
+/*
+ * Describe the gathered rows of |tile| with iovecs.
+ */
+
+static void
+tile_iovec(mc_t *mc, struct mc_tile *tile, struct mc_iov *o)
+{
+    size_t r;
+
+    for (r = 0; r < tile->nrows; ++r) {
+        size_t col;
+
+        iov_blanks(o, mc->indent);
+        for (col = 0; col < tile->cols; ++col) {
+            const char *elem = tile->elem[col * tile->stride + r];
+            size_t len = tile->len[col * tile->stride + r];
+
+            if (elem == NULL) {
+                break;
+            }
+            iov_add(o, elem, len);
+            iov_blanks(o, pad_length(mc, tile->cols, col, len));
+        }
+        iov_add(o, newline, 1);
+    }
+}
+
+static int
+write_rows(mc_t *mc, int fd, bool by_columns)
+{
+    struct mc_layout lo;
+    struct mc_tile tile;
+    struct mc_iov *o;
+    char text[TRAILER_MAX];
+    size_t tlen;
+    size_t row;
+    int err;
+
+    layout(mc, by_columns, &lo);
+    o = (struct mc_iov *) xnmalloc(1, sizeof (*o));
+    if (o == NULL) {
+        xalloc_die();
+    }
+    o->fd = fd;
+    o->err = 0;
+    o->n = 0;
+
+    tile_init(&tile, by_columns, lo.rows, lo.cols);
+    for (row = 0; row < lo.show && o->err == 0; row += tile.stride) {
+        (void) tile_gather(mc, &tile, row, MIN(tile.stride, lo.show - row));
+        tile_iovec(mc, &tile, o);
+    }
+    tlen = trailer_text(mc, &lo, text, sizeof (text));
+    if (tlen != 0) {
+        iov_blanks(o, mc->indent);
+        iov_add(o, text, tlen);
+    }
+    iov_flush(o);
+    tile_fini(&tile);
+
+    err = o->err;
+    free(o);
+    return (err);
+}
+
+/*
+ * Output with vmsplice(2), for pipes.
+ *
+ * Rows are rendered into page-aligned buffers, and the pages are
+ * handed to the pipe with vmsplice(), rather than copied into it.
+ * The pipe then refers to our pages until they are read, and maybe
+ * after that, if the reader splices them on elsewhere, so a page that
+ * has been spliced must never be written again.  Each buffer is
+ * therefore a fresh private anonymous mapping, which is unmapped as
+ * soon as it has been spliced; the kernel keeps the pages for as long
+ * as it needs them, and we never see them again.
+ *
+ * If vmsplice() is refused, the rest goes out with plain write().
+ */
+
+#define SPLICE_BUF_SIZE (256 * 1024)
+
+struct mc_splice {
+    int fd;
+    int err;
+    bool use_write;
+    size_t pagesize;
+    struct mc_buf out;
+};
+
+static void
+splice_new_buf(struct mc_splice *sp, size_t need)
+{
+    size_t siz = MAX(SPLICE_BUF_SIZE, need);
+    void *p;
+
+    siz = (siz + sp->pagesize - 1) / sp->pagesize * sp->pagesize;
+    p = mmap(NULL, siz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (p == MAP_FAILED) {
+        xalloc_die();
+    }
+    sp->out.p = (char *) p;
+    sp->out.siz = siz;
+    sp->out.len = 0;
+}
+
+/*
+ * Write out [p, p + len), spliced or written; see libmc.h.
+ * Short writes are resumed, and interrupted ones tried again.
+ */
+
+int
+mc_splice_out(int fd, const char *p, size_t len, bool *use_write, bool *spliced)
+{
+    while (len != 0) {
+        ssize_t rv;
+
+        if (*use_write) {
+            rv = write(fd, p, len);
+        }
+        else {
+            struct iovec iov;
+
+            iov.iov_base = (void *) p;
+            iov.iov_len = len;
+            rv = vmsplice(fd, &iov, 1, SPLICE_F_GIFT);
+            if (rv < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                *use_write = true;
+                continue;
+            }
+            if (rv > 0 && spliced != NULL) {
+                *spliced = true;
+            }
+        }
+
+        if (rv < 0) {
+            if (errno != EINTR) {
+                return (errno);
+            }
+            continue;
+        }
+        p += rv;
+        len -= rv;
+    }
+    return (0);
+}
+
+static void
+splice_flush(struct mc_splice *sp)
+{
+    if (sp->err == 0) {
+        sp->err = mc_splice_out(sp->fd, sp->out.p, sp->out.len, &sp->use_write, NULL);
+    }
+    munmap(sp->out.p, sp->out.siz);
+    sp->out.p = NULL;
+    sp->out.siz = 0;
+    sp->out.len = 0;
+}
+
+/*
+ * Make sure the current splice buffer has room for |need| more bytes.
+ */
+
+static void
+splice_reserve(struct mc_splice *sp, size_t need)
+{
+    if (sp->out.p != NULL && sp->out.len + need > sp->out.siz) {
+        splice_flush(sp);
+    }
+    if (sp->out.p == NULL) {
+        splice_new_buf(sp, need);
+    }
+}
+
+static int
+splice_rows(mc_t *mc, int fd, bool by_columns)
+{
+    struct mc_layout lo;
+    struct mc_splice sp;
+    struct mc_tile tile;
+    char text[TRAILER_MAX];
+    size_t tlen;
+    size_t row;
+
+    layout(mc, by_columns, &lo);
+    sp.fd = fd;
+    sp.err = 0;
+    sp.use_write = false;
+    sp.pagesize = sysconf(_SC_PAGESIZE);
+    sp.out.p = NULL;
+    sp.out.siz = 0;
+    sp.out.len = 0;
+
+    tile_init(&tile, by_columns, lo.rows, lo.cols);
+    tile.out = &sp.out;
+    for (row = 0; row < lo.show && sp.err == 0; row += tile.stride) {
+        splice_reserve(&sp, tile_gather(mc, &tile, row, MIN(tile.stride, lo.show - row)));
+        tile_render(mc, &tile);
+    }
+    tlen = trailer_text(mc, &lo, text, sizeof (text));
+    if (tlen != 0 && sp.err == 0) {
+        splice_reserve(&sp, mc->indent + tlen);
+        buf_trailer(mc, &sp.out, text, tlen);
+    }
+    if (sp.out.p != NULL) {
+        splice_flush(&sp);
+    }
+    tile_fini(&tile);
+
+    return (sp.err);
+}
+
+static bool
+is_pipe(int fd)
+{
+    struct stat st;
+
+    return (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode));
+}
+
+/*
+ * Number of threads to print with.  0 means one per online CPU.
+ */
+
+static size_t
+print_threads(const mc_t *mc)
+{
+    long ncpu;
+
+    if (mc->threads != 0) {
+        return (mc->threads);
+    }
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    return (ncpu > 1 ? (size_t) ncpu : 1);
+}
+
+/*
+ * Print through stdio.  Return 0, or the errno value of a failed write.
+ */
+
+static int
+print_rows(mc_t *mc, bool by_columns)
+{
+    struct mc_layout lo;
+    size_t nthreads = print_threads(mc);
+    struct mc_tile tile;
+    struct mc_buf out;
+    char text[TRAILER_MAX];
+    size_t tlen;
+    size_t row;    /* First row of the current tile.  */
+    int err;
+
+    layout(mc, by_columns, &lo);
+    memset(&out, 0, sizeof (out));
+    err = 0;
+
+    if (nthreads > 1 && mc->nelem >= PARALLEL_MIN_ELEMS) {
+        err = print_rows_parallel(mc, by_columns, lo.rows, lo.cols, lo.show, nthreads);
+    }
+    else {
+        tile_init(&tile, by_columns, lo.rows, lo.cols);
+        tile.out = &out;
+        for (row = 0; row < lo.show && err == 0; row += tile.stride) {
+            render_rows(mc, &tile, row, MIN(tile.stride, lo.show - row));
+            if (fwrite(out.p, 1, out.len, mc->f) != out.len) {
+                err = errno ? errno : EIO;
+            }
+            out.len = 0;
+        }
+        tile_fini(&tile);
+    }
+
+    tlen = trailer_text(mc, &lo, text, sizeof (text));
+    if (tlen != 0 && err == 0) {
+        buf_reserve(&out, mc->indent + tlen);
+        buf_trailer(mc, &out, text, tlen);
+        if (fwrite(out.p, 1, out.len, mc->f) != out.len) {
+            err = errno ? errno : EIO;
+        }
+    }
+    free(out.p);
+    return (err);
+}
+
+static const char *engine_names[MC_ENGINE_COUNT] = {
+    "default",
+    "full",
+    "prune",
+    "descend",
+    "sample",
+};
+
+const char *
+mc_engine_name(enum mc_engine engine)
+{
+    if ((unsigned int) engine >= MC_ENGINE_COUNT) {
+        return ("unknown");
+    }
+    return (engine_names[engine]);
+}
+
+/*
+ * Map an engine name to an engine.  Return -1 if there is no such engine.
+ */
+
+int
+mc_engine_lookup(const char *name)
+{
+    int i;
+
+    for (i = 0; i < MC_ENGINE_COUNT; ++i) {
+        if (strcmp(name, engine_names[i]) == 0) {
+            return (i);
+        }
+    }
+    return (-1);
+}
+
+void
+mc_opt_init(mc_opt_t *opt)
+{
+    opt->llen = 80;
+    opt->indent = 0;
+    opt->horizontal = false;
+    opt->engine = MC_ENGINE_DEFAULT;
+    opt->cell_bits = 0;
+    opt->threads = 1;
+    opt->lengths = NULL;
+    opt->splice = false;
+    opt->max_rows = 0;
+    opt->trailer = false;
+    opt->stable = NULL;
+    opt->cache = NULL;
+    opt->columns = 0;
+    opt->col_width = 0;
+    opt->overflow = MC_OVERFLOW_TRUNCATE;
+    opt->packed = NULL;
+    opt->window = 0;
+    opt->auto_orientation = false;
+    opt->uniform = false;
+}
+
+void
+mc_widths_init(struct mc_widths *stable)
+{
+    stable->cols = 0;
+    stable->widths = NULL;
+    stable->alloc = 0;
+}
+
+void
+mc_widths_fini(struct mc_widths *stable)
+{
+    free(stable->widths);
+    mc_widths_init(stable);
+}
+
+void
+mc_cache_init(struct mc_cache *cache)
+{
+    cache->nelem = 0;
+    cache->lengths = NULL;
+    cache->alloc = 0;
+    cache->by_columns = true;
+    mc_widths_init(&cache->widths);
+}
+
+void
+mc_cache_fini(struct mc_cache *cache)
+{
+    free(cache->lengths);
+    mc_widths_fini(&cache->widths);
+    mc_cache_init(cache);
+}
+
+static void
+mc_init(mc_t *mc, FILE *f, size_t nelem, const char **elemv, const mc_opt_t *opt)
+{
+    mc->nelem  = nelem;
+    mc->elemv  = elemv;
+    mc->llen   = opt->llen;
+    mc->indent = opt->indent;
+    mc->column_info = NULL;
+    mc->column_info_alloc = 0;
+    mc->max_idx = mc->llen / MIN_COLUMN_WIDTH;
+    if (mc->max_idx < 1) {
+        mc->max_idx = 1;
+    }
+    mc->f = f;
+    mc->threads = opt->threads;
+    mc->lengths = opt->lengths;
+    mc->max_rows = opt->max_rows;
+    mc->trailer = opt->trailer;
+    mc->stable = opt->stable;
+    mc->cache = opt->stable == NULL ? opt->cache : NULL;
+    mc->cache_hit = false;
+    mc->packed = opt->packed;
+    mc->marks = NULL;
+    mc->auto_cols = 0;
+    mc->uniform = opt->uniform;
+    mc_simd_select();
+    mc->engine = opt->engine;
+    if (mc->engine == MC_ENGINE_DEFAULT) {
+        mc->engine = MC_ENGINE_DESCEND;
+    }
+    mc->live = NULL;
+    mc->valid = NULL;
+    mc->widths = (size_t *) xnmalloc(mc->max_idx, sizeof (*mc->widths));
+    if (mc->widths == NULL) {
+        xalloc_die();
+    }
+    choose_cell_bits(mc, opt->cell_bits);
+    measure_elements(mc);
+    if (mc->packed != NULL) {
+        init_marks(mc);
+    }
+    if (mc->cache != NULL) {
+        mc->cache_hit = cache_matches(mc, opt);
+    }
+}
+
+/*
+ * Release everything allocated on behalf of |mc|.
+ *
+ * The column_info triangle is grown at most once per mc_t,
+ * because max_cols does not change over its lifetime,
+ * so all of its cells belong to a single allocation.
+ */
+
+static void
+mc_fini(mc_t *mc)
+{
+    switch (mc->cell_bits) {
+    case 16:
+        fini_column_info_16(mc);
+        break;
+    case 32:
+        fini_column_info_32(mc);
+        break;
+    default:
+        fini_column_info_64(mc);
+        break;
+    }
+    free(mc->column_info);
+    free(mc->lenv);
+    free(mc->valid);
+    free(mc->widths);
+    free(mc->marks);
+}
+
+/*
+ * Return the number of columns that |opt| would lay out |elemv| in,
+ * without printing anything.
+ */
+
+size_t
+mc_columns(size_t nelem, const char **elemv, const mc_opt_t *opt)
+{
+    mc_t mcbuf;
+    mc_t *mc = &mcbuf;
+    size_t cols;
+
+    if (nelem == 0) {
+        return (0);
+    }
+
+    mc_init(mc, NULL, nelem, elemv, opt);
+    cols = choose_columns(mc, choose_orientation(mc, opt));
+    mc_fini(mc);
+    return (cols);
+}
+
+static int
+cmp_plan_llen_decreasing(const void *a, const void *b)
+{
+    size_t la = (*(struct mc_plan * const *) a)->llen;
+    size_t lb = (*(struct mc_plan * const *) b)->llen;
+
+    return ((la < lb) - (la > lb));
+}
+
+/*
+ * Lay out |elemv| at each of the display widths plans[k].llen,
+ * in one go, and fill in the rest of each plan.  opt->llen is not used.
+ *
+ * Lengths are measured once, for all widths, and every candidate
+ * number of columns is evaluated at most once, however many widths
+ * there are: widths are done widest first, and what is learned about
+ * a candidate at one width carries over to all narrower ones.
+ * See calculate_plans() in mc-engine.h.
+ */
+
+void
+mc_plans(size_t nelem, const char **elemv, const mc_opt_t *opt,
+    size_t nplans, struct mc_plan *plans)
+{
+    struct mc_plan **byw;
+    mc_opt_t wopt;
+    mc_t mcbuf;
+    mc_t *mc = &mcbuf;
+    size_t k;
+
+    if (nplans == 0) {
+        return;
+    }
+    byw = (struct mc_plan **) xnmalloc(nplans, sizeof (*byw));
+    if (byw == NULL) {
+        xalloc_die();
+    }
+    for (k = 0; k < nplans; ++k) {
+        byw[k] = &plans[k];
+        plans[k].cols = 0;
+        plans[k].rows = 0;
+        plans[k].widths = NULL;
+        plans[k].horizontal = opt->horizontal;
+    }
+    if (nelem == 0) {
+        free(byw);
+        return;
+    }
+    qsort(byw, nplans, sizeof (*byw), cmp_plan_llen_decreasing);
+
+    // Cells and lengths sized for the widest
+    wopt = *opt;
+    wopt.llen = byw[0]->llen;
+    wopt.stable = NULL;
+    wopt.cache = NULL;
+    mc_init(mc, NULL, nelem, elemv, &wopt);
+    calculate_plans(mc, !opt->horizontal, nplans, byw);
+    mc_fini(mc);
+    free(byw);
+}
+
+/*
+ * The layout that mc_print() would print |elemv| in, with |opt|,
+ * without printing anything: fill in |plan| with its number of
+ * columns and rows, their widths, and its orientation.
+ * opt->stable is used and updated, as by mc_print().
+ */
+
+void
+mc_plan(size_t nelem, const char **elemv, const mc_opt_t *opt, struct mc_plan *plan)
+{
+    mc_t mcbuf;
+    mc_t *mc = &mcbuf;
+    bool by_columns;
+    size_t cols;
+
+    plan->llen = opt->llen;
+    plan->cols = 0;
+    plan->rows = 0;
+    plan->widths = NULL;
+    plan->horizontal = opt->horizontal;
+    if (nelem == 0) {
+        return;
+    }
+
+    mc_init(mc, NULL, nelem, elemv, opt);
+    by_columns = choose_orientation(mc, opt);
+    cols = choose_columns(mc, by_columns);
+    plan->cols = cols;
+    plan->rows = (nelem + cols - 1) / cols;
+    plan->horizontal = !by_columns;
+    plan->widths = (size_t *) xnmalloc(cols, sizeof (*plan->widths));
+    if (plan->widths == NULL) {
+        xalloc_die();
+    }
+    memcpy(plan->widths, mc->widths, cols * sizeof (*plan->widths));
+    if (cols == 1) {
+        plan->widths[0] = MAX(mc->max_len, MIN_COLUMN_WIDTH);
+    }
+    mc_fini(mc);
+}
+
+void
+mc_plan_fini(struct mc_plan *plan)
+{
+    free(plan->widths);
+    plan->widths = NULL;
+    plan->cols = 0;
+    plan->rows = 0;
+}
+
+/*
+ * The layout of |elemv| at every display width from 1 to opt->llen,
+ * as a table of the widths at which the layout changes.
+ * Store the number of entries in *|nplans|.
+ * See calculate_breakpoints() in mc-engine.h.
+ */
+
+struct mc_plan *
+mc_breakpoints(size_t nelem, const char **elemv, const mc_opt_t *opt, size_t *nplans)
+{
+    struct mc_plan *table;
+    mc_t mcbuf;
+    mc_t *mc = &mcbuf;
+    mc_opt_t wopt;
+    size_t k;
+
+    if (nelem == 0) {
+        *nplans = 0;
+        return (NULL);
+    }
+
+    wopt = *opt;
+    wopt.stable = NULL;
+    wopt.cache = NULL;
+    mc_init(mc, NULL, nelem, elemv, &wopt);
+    table = (struct mc_plan *) xnmalloc(mc->max_idx, sizeof (*table));
+    if (table == NULL) {
+        xalloc_die();
+    }
+    *nplans = calculate_breakpoints(mc, !opt->horizontal, table);
+    mc_fini(mc);
+    for (k = 0; k < *nplans; ++k) {
+        table[k].horizontal = opt->horizontal;
+    }
+    return (table);
+}
+
+/*
+ * The entry of |table| that holds for display width |llen|:
+ * the last one whose llen is not greater.
+ */
+
+const struct mc_plan *
+mc_breakpoint_find(const struct mc_plan *table, size_t nplans, size_t llen)
+{
+    size_t lo = 0;
+    size_t hi = nplans;
+
+    if (nplans == 0) {
+        return (NULL);
+    }
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (table[mid].llen <= llen) {
+            lo = mid;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return (&table[lo]);
+}
+
+/*
+ * Find the narrowest display width, up to opt->llen, at which
+ * |elemv| is laid out in at most |max_rows| rows, and fill in |plan|
+ * with that width and its layout.  Return 0, or ERANGE, leaving
+ * |plan| empty, if no width up to opt->llen will do.
+ * See calculate_fit() in mc-engine.h.
+ */
+
+int
+mc_fit_rows(size_t nelem, const char **elemv, const mc_opt_t *opt, size_t max_rows, struct mc_plan *plan)
+{
+    mc_t mcbuf;
+    mc_t *mc = &mcbuf;
+    mc_opt_t wopt;
+    bool found;
+
+    plan->llen = 0;
+    plan->cols = 0;
+    plan->rows = 0;
+    plan->widths = NULL;
+    plan->horizontal = opt->horizontal;
+    if (opt->indent >= opt->llen) {
+        return (ERANGE);
+    }
+    if (nelem == 0) {
+        plan->llen = opt->indent + 1;
+        return (0);
+    }
+    if (max_rows == 0) {
+        return (ERANGE);
+    }
+
+    wopt = *opt;
+    wopt.stable = NULL;
+    wopt.cache = NULL;
+    mc_init(mc, NULL, nelem, elemv, &wopt);
+    found = calculate_fit(mc, !opt->horizontal, max_rows, plan);
+    mc_fini(mc);
+    return (found ? 0 : ERANGE);
+}
+
+/*
+ * Lay out |elemv| in at most |rows| rows, with as few columns as
+ * that allows, whatever the display width, and fill in |plan|.
+ * Return 0, or EINVAL if |rows| is 0.
+ * See calculate_rows() in mc-engine.h.
+ */
+
+int
+mc_plan_rows(size_t nelem, const char **elemv, const mc_opt_t *opt, size_t rows, struct mc_plan *plan)
+{
+    mc_t mcbuf;
+    mc_t *mc = &mcbuf;
+    mc_opt_t wopt;
+
+    plan->llen = opt->indent;
+    plan->cols = 0;
+    plan->rows = 0;
+    plan->widths = NULL;
+    plan->horizontal = opt->horizontal;
+    if (rows == 0) {
+        return (EINVAL);
+    }
+    if (nelem == 0) {
+        return (0);
+    }
+
+    wopt = *opt;
+    wopt.stable = NULL;
+    wopt.cache = NULL;
+    mc_init(mc, NULL, nelem, elemv, &wopt);
+    calculate_rows(mc, !opt->horizontal, rows, plan);
+    mc_fini(mc);
+    return (0);
+}
+
+void
+mc_breakpoints_free(struct mc_plan *table, size_t nplans)
+{
+    size_t k;
+
+    for (k = 0; k < nplans; ++k) {
+        mc_plan_fini(&table[k]);
+    }
+    free(table);
+}
+
+/*
+ * Print to |f|.  Stop at the first failed write.
+ * Return 0, or the errno value of the write that failed.
+ */
+
+int
+mc_print(FILE *f, size_t nelem, const char **elemv, const mc_opt_t *opt)
+{
+    mc_t mcbuf;
+    mc_t *mc = &mcbuf;
+    int err;
+
+    if (nelem == 0) {
+        return (0);
+    }
+
+    mc_init(mc, f, nelem, elemv, opt);
+    err = print_rows(mc, choose_orientation(mc, opt));
+    mc_fini(mc);
+    return (err);
+}
+
+/*
+ * Like mc_print(), but write to the file descriptor |fd|, with
+ * writev(2), straight from the bytes of the elements, or, if
+ * opt->splice is set and |fd| is a pipe, with vmsplice(2).
+ * Return 0, or the errno value of the write that failed.
+ */
+
+int
+mc_write(int fd, size_t nelem, const char **elemv, const mc_opt_t *opt)
+{
+    mc_t mcbuf;
+    mc_t *mc = &mcbuf;
+    bool by_columns;
+    int err;
+
+    if (nelem == 0) {
+        return (0);
+    }
+
+    mc_init(mc, NULL, nelem, elemv, opt);
+    by_columns = choose_orientation(mc, opt);
+    if (opt->splice && is_pipe(fd)) {
+        err = splice_rows(mc, fd, by_columns);
+    }
+    else {
+        err = write_rows(mc, fd, by_columns);
+    }
+    mc_fini(mc);
+    return (err);
+}
+
+int
+mc(FILE *f, size_t nelem, const char **elemv, size_t llen, size_t indent, bool horizontal)
+{
+    mc_opt_t opt;
+
+    mc_opt_init(&opt);
+    opt.llen = llen;
+    opt.indent = indent;
+    opt.horizontal = horizontal;
+    return (mc_print(f, nelem, elemv, &opt));
 }
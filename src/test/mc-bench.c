@@ -0,0 +1,344 @@
+/*
+ * Filename: src/test/mc-bench.c
+ * Project: mcml / libmc
+ * Brief: Benchmark the libmc layout engines on synthetic lists
+ *
+ * Copyright (C) 2016 Guy Shaw
+ * Written by Guy Shaw <gshaw@acm.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+    // Import type bool
+    // Import constant false
+    // Import constant true
+#include <stdio.h>
+    // Import fclose()
+    // Import fflush()
+    // Import fileno()
+    // Import fopen()
+    // Import perror()
+    // Import printf()
+#include <stdlib.h>
+    // Import exit()
+    // Import free()
+    // Import malloc()
+    // Import rand()
+    // Import srand()
+    // Import strtoul()
+#include <string.h>
+    // Import memset()
+    // Import strdup()
+    // Import strlen()
+#include <time.h>
+    // Import clock_gettime()
+#include <unistd.h>
+    // Import type size_t
+
+#include <libmc.h>
+
+/*
+ * Length distributions.
+ *
+ * uniform:
+ *     Lengths spread evenly over 8..23.  Typical of command names.
+ *
+ * longtail:
+ *     Mostly short names, with a few very long ones.
+ *     Typical of package names or paths.
+ */
+
+enum dist {
+    DIST_UNIFORM,
+    DIST_LONGTAIL,
+    DIST_COUNT
+};
+
+static const char *dist_names[DIST_COUNT] = {
+    "uniform",
+    "longtail",
+};
+
+#define MAX_ELEM_LEN 255
+
+static size_t
+random_length(enum dist dist)
+{
+    int r;
+
+    switch (dist) {
+    case DIST_UNIFORM:
+        return (8 + rand() % 16);
+    case DIST_LONGTAIL:
+    default:
+        r = rand() % 1000;
+        if (r == 0) {
+            return (60 + rand() % 100);
+        }
+        if (r < 50) {
+            return (16 + rand() % 40);
+        }
+        return (2 + rand() % 10);
+    }
+}
+
+/*
+ * Build a list of |nelem| elements.  All elements are suffixes
+ * of one shared string, so only the lengths matter.
+ */
+
+static const char **
+make_list(size_t nelem, enum dist dist)
+{
+    static char pool[MAX_ELEM_LEN + 1];
+    const char **elemv;
+    size_t enr;
+
+    memset(pool, 'x', MAX_ELEM_LEN);
+    elemv = (const char **) malloc(nelem * sizeof (*elemv));
+    if (elemv == NULL) {
+        perror("malloc");
+        exit(2);
+    }
+
+    srand(1);
+    for (enr = 0; enr < nelem; ++enr) {
+        elemv[enr] = pool + MAX_ELEM_LEN - random_length(dist);
+    }
+    return (elemv);
+}
+
+/*
+ * Copy each element into its own heap block, as a program that
+ * reads its input line by line would, so that printing touches
+ * memory the way it would in real use.
+ */
+
+static char **
+copy_list(size_t nelem, const char **elemv)
+{
+    char **copyv;
+    size_t enr;
+
+    copyv = (char **) malloc(nelem * sizeof (*copyv));
+    if (copyv == NULL) {
+        perror("malloc");
+        exit(2);
+    }
+    for (enr = 0; enr < nelem; ++enr) {
+        copyv[enr] = strdup(elemv[enr]);
+        if (copyv[enr] == NULL) {
+            perror("strdup");
+            exit(2);
+        }
+    }
+    return (copyv);
+}
+
+static void
+free_list(size_t nelem, char **copyv)
+{
+    size_t enr;
+
+    for (enr = 0; enr < nelem; ++enr) {
+        free(copyv[enr]);
+    }
+    free(copyv);
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/*
+ * Usage: mc-bench [ <nelem> [ <width> [ <cell-bits> [ <threads> ] ] ] ]
+ */
+
+int
+main(int argc, char **argv)
+{
+    size_t nelem = 1000000;
+    size_t llen = 200;
+    unsigned int cell_bits = 0;
+    unsigned int threads = 1;
+    int d;
+
+    if (argc > 1) {
+        nelem = strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        llen = strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        cell_bits = strtoul(argv[3], NULL, 10);
+    }
+    if (argc > 4) {
+        threads = strtoul(argv[4], NULL, 10);
+    }
+
+    printf("nelem=%zu width=%zu cell-bits=%u threads=%u simd=%s\n",
+        nelem, llen, cell_bits, threads, mc_simd_variant());
+    printf("%-10s %-11s %-8s %6s %10s\n",
+        "dist", "orientation", "engine", "cols", "msec");
+
+    for (d = 0; d < DIST_COUNT; ++d) {
+        const char **elemv = make_list(nelem, (enum dist) d);
+        int horizontal;
+
+        for (horizontal = 0; horizontal <= 1; ++horizontal) {
+            size_t ref_cols = 0;
+            int engine;
+
+            for (engine = MC_ENGINE_FULL; engine < MC_ENGINE_COUNT; ++engine) {
+                mc_opt_t opt;
+                double t0;
+                double t1;
+                size_t cols;
+
+                mc_opt_init(&opt);
+                opt.llen = llen;
+                opt.horizontal = horizontal;
+                opt.engine = (enum mc_engine) engine;
+                opt.cell_bits = cell_bits;
+
+                t0 = now();
+                cols = mc_columns(nelem, elemv, &opt);
+                t1 = now();
+
+                if (engine == MC_ENGINE_FULL) {
+                    ref_cols = cols;
+                }
+                printf("%-10s %-11s %-8s %6zu %10.2f%s\n",
+                    dist_names[d], horizontal ? "horizontal" : "vertical",
+                    mc_engine_name(opt.engine), cols, (t1 - t0) * 1000.0,
+                    cols == ref_cols ? "" : "  MISMATCH");
+            }
+
+            /*
+             * The incremental engine, as used by mcml --follow,
+             * fed one element at a time.
+             */
+            {
+                mc_opt_t opt;
+                mc_follow_t *fl;
+                double t0;
+                double t1;
+                size_t cols;
+                size_t enr;
+
+                mc_opt_init(&opt);
+                opt.llen = llen;
+                opt.horizontal = horizontal;
+
+                t0 = now();
+                fl = mc_follow_new(&opt);
+                for (enr = 0; enr < nelem; ++enr) {
+                    mc_follow_add(fl, strlen(elemv[enr]));
+                }
+                cols = mc_follow_columns(fl);
+                t1 = now();
+                mc_follow_free(fl);
+
+                printf("%-10s %-11s %-8s %6zu %10.2f%s\n",
+                    dist_names[d], horizontal ? "horizontal" : "vertical",
+                    "follow", cols, (t1 - t0) * 1000.0,
+                    cols == ref_cols ? "" : "  MISMATCH");
+            }
+        }
+
+        /*
+         * Time layout plus printing, with the default engine,
+         * to /dev/null, from separately allocated copies.
+         */
+        {
+            char **copyv = copy_list(nelem, elemv);
+            FILE *null = fopen("/dev/null", "w");
+
+            if (null == NULL) {
+                perror("/dev/null");
+                exit(2);
+            }
+            for (horizontal = 0; horizontal <= 1; ++horizontal) {
+                mc_opt_t opt;
+                double t0;
+                double t1;
+
+                mc_opt_init(&opt);
+                opt.llen = llen;
+                opt.horizontal = horizontal;
+                opt.cell_bits = cell_bits;
+                opt.threads = threads;
+
+                t0 = now();
+                mc_print(null, nelem, (const char **) copyv, &opt);
+                fflush(null);
+                t1 = now();
+
+                printf("%-10s %-11s %-8s %6s %10.2f\n",
+                    dist_names[d], horizontal ? "horizontal" : "vertical",
+                    "print", "", (t1 - t0) * 1000.0);
+            }
+            for (horizontal = 0; horizontal <= 1; ++horizontal) {
+                mc_opt_t opt;
+                double t0;
+                double t1;
+
+                mc_opt_init(&opt);
+                opt.llen = llen;
+                opt.horizontal = horizontal;
+                opt.cell_bits = cell_bits;
+
+                t0 = now();
+                mc_write(fileno(null), nelem, (const char **) copyv, &opt);
+                t1 = now();
+
+                printf("%-10s %-11s %-8s %6s %10.2f\n",
+                    dist_names[d], horizontal ? "horizontal" : "vertical",
+                    "writev", "", (t1 - t0) * 1000.0);
+            }
+            for (horizontal = 0; horizontal <= 1; ++horizontal) {
+                mc_opt_t opt;
+                double t0;
+                double t1;
+
+                mc_opt_init(&opt);
+                opt.llen = llen;
+                opt.horizontal = horizontal;
+                opt.cell_bits = cell_bits;
+                opt.threads = threads;
+                opt.uniform = true;
+
+                t0 = now();
+                mc_print(null, nelem, (const char **) copyv, &opt);
+                fflush(null);
+                t1 = now();
+
+                printf("%-10s %-11s %-8s %6s %10.2f\n",
+                    dist_names[d], horizontal ? "horizontal" : "vertical",
+                    "uniform", "", (t1 - t0) * 1000.0);
+            }
+            fclose(null);
+            free_list(nelem, copyv);
+        }
+        free(elemv);
+    }
+
+    return (0);
+}
@@ -20,18 +20,41 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
+    // Import constant ERANGE
 #include <stdbool.h>
     // Import type bool
     // Import constant false
     // Import constant true
 #include <stdio.h>
     // Import type FILE
+    // Import fclose()
+    // Import fopen()
+    // Import open_memstream()
     // Import printf()
+    // Import setvbuf()
+    // Import snprintf()
     // Import var stdout
+#include <stdlib.h>
+    // Import free()
+    // Import malloc()
+    // Import mkstemp()
+    // Import rand()
+    // Import srand()
+#include <string.h>
+    // Import memset()
+    // Import strchr()
+    // Import strcmp()
+    // Import strlen()
 #include <unistd.h>
+    // Import close()
+    // Import pipe()
+    // Import pread()
+    // Import read()
+    // Import unlink()
     // Import type size_t
 
-extern int mc(FILE *f, size_t nelem, const char **elemv, size_t llen, bool horizontal);
+#include <libmc.h>
 
 static const char *names[] = {
     "1",
@@ -51,16 +74,1514 @@ static const char *names[] = {
     "another-long-name",
 };
 
+/*
+ * Render a list into a string, so that the output of different
+ * layout engines can be compared.  Caller frees the result.
+ */
+
+static char *
+render(size_t nelem, const char **elemv, const mc_opt_t *opt)
+{
+    char *buf;
+    size_t sz;
+    FILE *f;
+
+    f = open_memstream(&buf, &sz);
+    mc_print(f, nelem, elemv, opt);
+    fclose(f);
+    return (buf);
+}
+
+/*
+ * A string of |len| x's, at most 511; shared, never to be freed.
+ */
+
+static const char *
+x_string(size_t len)
+{
+    static char pool[512];
+
+    if (pool[0] == '\0') {
+        memset(pool, 'x', sizeof (pool) - 1);
+    }
+    return (pool + sizeof (pool) - 1 - len);
+}
+
+/*
+ * A list of |nelem| random elements, seeded with |seed|: mostly 1 to
+ * |short_max| long, but about one in |long_every| from long_min to
+ * long_min + long_span - 1 long.  Caller frees the array.
+ */
+
+static const char **
+random_list(size_t nelem, unsigned int seed, size_t short_max,
+    int long_every, size_t long_min, size_t long_span)
+{
+    const char **elemv;
+    size_t enr;
+
+    elemv = (const char **) malloc(nelem * sizeof (*elemv));
+    srand(seed);
+    for (enr = 0; enr < nelem; ++enr) {
+        size_t len = rand() % long_every == 0 ? long_min + rand() % long_span : 1 + rand() % short_max;
+
+        elemv[enr] = x_string(len);
+    }
+    return (elemv);
+}
+
+/*
+ * Every engine, with the narrowest cells that libmc considers safe,
+ * must produce exactly the same output as the reference engine,
+ * MC_ENGINE_FULL, with 64-bit cells.
+ */
+
+static int
+compare_engines(size_t nelem, const char **elemv, size_t llen, size_t indent, bool horizontal)
+{
+    mc_opt_t opt;
+    char *expect;
+    int engine;
+    int errors;
+
+    mc_opt_init(&opt);
+    opt.llen = llen;
+    opt.indent = indent;
+    opt.horizontal = horizontal;
+    opt.engine = MC_ENGINE_FULL;
+    opt.cell_bits = 64;
+    expect = render(nelem, elemv, &opt);
+    opt.cell_bits = 0;
+
+    errors = 0;
+    for (engine = MC_ENGINE_FULL; engine < MC_ENGINE_COUNT; ++engine) {
+        char *got;
+
+        opt.engine = (enum mc_engine) engine;
+        got = render(nelem, elemv, &opt);
+        if (strcmp(got, expect) != 0) {
+            printf("FAIL: engine=%s nelem=%zu llen=%zu indent=%zu horizontal=%d\n",
+                mc_engine_name(opt.engine), nelem, llen, indent, horizontal);
+            ++errors;
+        }
+        free(got);
+    }
+    free(expect);
+    return (errors);
+}
+
+/*
+ * Build lists of random elements, with a long tail of lengths,
+ * and compare engines, in each orientation, over a range of
+ * display widths.  Now and then, try a display wide enough
+ * to need 32-bit cells.
+ */
+
+static int
+test_engines(void)
+{
+    static char pool[200];
+    const char *elemv[300];
+    size_t trial;
+    int horizontal;
+    int errors;
+
+    memset(pool, 'x', sizeof (pool) - 1);
+    srand(1);
+    errors = 0;
+
+    for (trial = 0; trial < 200; ++trial) {
+        size_t nelem = 1 + rand() % 300;
+        size_t enr;
+        size_t llen;
+
+        for (enr = 0; enr < nelem; ++enr) {
+            size_t len = 1 + rand() % 12;
+            if (rand() % 20 == 0) {
+                len += rand() % 120;
+            }
+            elemv[enr] = pool + sizeof (pool) - 1 - len;
+        }
+
+        for (horizontal = 0; horizontal <= 1; ++horizontal) {
+            for (llen = 1; llen <= 200; llen += 1 + rand() % 16) {
+                errors += compare_engines(nelem, elemv, llen, rand() % 5, horizontal);
+                if (trial % 10 == 0) {
+                    errors += compare_engines(nelem, elemv, llen, llen, horizontal);
+                }
+            }
+            if (trial % 50 == 0) {
+                errors += compare_engines(nelem, elemv, 70000, 0, horizontal);
+            }
+        }
+    }
+
+    /*
+     * With indent == llen, nothing fits but columns of the minimum
+     * width, so an element one longer than that must still rule out
+     * every candidate it is in, clamped or not.
+     */
+    for (horizontal = 0; horizontal <= 1; ++horizontal) {
+        static const char *two[] = { "z", "foyp" };
+        static const char *expect = "      z\n      foyp\n";
+        mc_opt_t opt;
+        int engine;
+
+        mc_opt_init(&opt);
+        opt.llen = 6;
+        opt.indent = 6;
+        opt.horizontal = horizontal;
+        for (engine = MC_ENGINE_FULL; engine < MC_ENGINE_COUNT; ++engine) {
+            char *got;
+
+            opt.engine = (enum mc_engine) engine;
+            got = render(2, two, &opt);
+            if (strcmp(got, expect) != 0) {
+                printf("FAIL: engine=%s indent == llen horizontal=%d\n",
+                    mc_engine_name(opt.engine), horizontal);
+                ++errors;
+            }
+            free(got);
+        }
+    }
+
+    return (errors);
+}
+
+/*
+ * Rendering with several threads must give the same output as
+ * rendering with one.  The list is big enough to be split into
+ * many rounds of bands, with a short final round.
+ */
+
+static int
+test_threads(void)
+{
+    static char pool[64];
+    size_t nelem = 300007;
+    const char **elemv;
+    size_t enr;
+    size_t llen;
+    int horizontal;
+    int errors;
+
+    memset(pool, 'x', sizeof (pool) - 1);
+    elemv = (const char **) malloc(nelem * sizeof (*elemv));
+    srand(2);
+    for (enr = 0; enr < nelem; ++enr) {
+        elemv[enr] = pool + sizeof (pool) - 1 - (1 + rand() % 20);
+    }
+
+    errors = 0;
+    for (horizontal = 0; horizontal <= 1; ++horizontal) {
+        for (llen = 20; llen <= 320; llen += 100) {
+            mc_opt_t opt;
+            char *expect;
+            char *got;
+
+            mc_opt_init(&opt);
+            opt.llen = llen;
+            opt.indent = 2;
+            opt.horizontal = horizontal;
+            expect = render(nelem, elemv, &opt);
+            opt.threads = 3;
+            got = render(nelem, elemv, &opt);
+            if (strcmp(got, expect) != 0) {
+                printf("FAIL: threads=%u llen=%zu horizontal=%d\n",
+                    opt.threads, llen, horizontal);
+                ++errors;
+            }
+            free(got);
+            free(expect);
+        }
+    }
+
+    /*
+     * A write that fails must stop every thread on the same round,
+     * so that printing returns, with the error, and does not hang.
+     */
+    for (enr = 0; enr < 20; ++enr) {
+        FILE *full = fopen("/dev/full", "w");
+        mc_opt_t opt;
+
+        if (full == NULL) {
+            break;
+        }
+        setvbuf(full, NULL, _IONBF, 0);
+        mc_opt_init(&opt);
+        opt.llen = 80;
+        opt.horizontal = enr % 2;
+        opt.threads = 3;
+        if (mc_print(full, nelem, elemv, &opt) == 0) {
+            printf("FAIL: threads=3 on /dev/full, no error\n");
+            ++errors;
+        }
+        fclose(full);
+    }
+
+    free(elemv);
+    return (errors);
+}
+
+/*
+ * With max_rows, the output must be the first max_rows lines
+ * of the full output, then a trailer that counts the elements
+ * on the lines left out.  mc_write() must agree.
+ */
+
+static size_t
+count_words(const char *p)
+{
+    size_t n = 0;
+
+    for (; *p; ++p) {
+        if (*p != ' ' && *p != '\n' && (p[1] == ' ' || p[1] == '\n' || p[1] == '\0')) {
+            ++n;
+        }
+    }
+    return (n);
+}
+
+static int
+test_max_rows(void)
+{
+    size_t nelem = sizeof (names) / sizeof (*names);
+    size_t llen;
+    int errors;
+
+    errors = 0;
+    for (llen = 10; llen <= 90; llen += 8) {
+        int horizontal;
+
+        for (horizontal = 0; horizontal <= 1; ++horizontal) {
+            size_t max_rows;
+
+            for (max_rows = 1; max_rows <= 6; ++max_rows) {
+                mc_opt_t opt;
+                char expect[4096];
+                char *full;
+                char *got;
+                char *cut;
+                size_t row;
+                size_t omitted;
+
+                mc_opt_init(&opt);
+                opt.llen = llen;
+                opt.indent = 2;
+                opt.horizontal = horizontal;
+                full = render(nelem, names, &opt);
+
+                cut = full;
+                for (row = 0; row < max_rows && *cut; ++row) {
+                    cut = strchr(cut, '\n') + 1;
+                }
+                omitted = count_words(cut);
+                snprintf(expect, sizeof (expect), "%.*s", (int) (cut - full), full);
+                if (omitted != 0) {
+                    snprintf(expect + strlen(expect), sizeof (expect) - strlen(expect),
+                        "  ... %zu more\n", omitted);
+                }
+
+                opt.max_rows = max_rows;
+                opt.trailer = true;
+                got = render(nelem, names, &opt);
+                if (strcmp(got, expect) != 0) {
+                    printf("FAIL: max_rows=%zu llen=%zu horizontal=%d\n",
+                        max_rows, llen, horizontal);
+                    ++errors;
+                }
+                free(got);
+
+                {
+                    char tmpl[] = "/tmp/mc-test.XXXXXX";
+                    char buf[4096];
+                    ssize_t n;
+                    int fd;
+
+                    fd = mkstemp(tmpl);
+                    unlink(tmpl);
+                    n = -1;
+                    if (fd >= 0 && mc_write(fd, nelem, names, &opt) == 0) {
+                        n = pread(fd, buf, sizeof (buf) - 1, 0);
+                    }
+                    buf[n < 0 ? 0 : n] = '\0';
+                    if (strcmp(buf, expect) != 0) {
+                        printf("FAIL: mc_write max_rows=%zu llen=%zu horizontal=%d\n",
+                            max_rows, llen, horizontal);
+                        ++errors;
+                    }
+                    if (fd >= 0) {
+                        close(fd);
+                    }
+                }
+                free(full);
+            }
+        }
+    }
+    return (errors);
+}
+
+/*
+ * Widths kept across calls are used again only while they fit.
+ * A list that fits them keeps their number of columns; a list that
+ * does not is laid out exactly as it would be with nothing kept.
+ */
+
+static int
+test_stable(void)
+{
+    static const char *shorter[] = {
+        "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m", "n", "o",
+    };
+    static const char *longer[] = {
+        "1", "2", "a-much-much-longer-line-than-any",
+    };
+    size_t nelem = sizeof (names) / sizeof (*names);
+    size_t llen;
+    int errors;
+
+    errors = 0;
+    for (llen = 20; llen <= 120; llen += 10) {
+        int horizontal;
+
+        for (horizontal = 0; horizontal <= 1; ++horizontal) {
+            struct mc_widths stable;
+            mc_opt_t opt;
+            size_t cols;
+            char *expect;
+            char *got;
+
+            mc_opt_init(&opt);
+            opt.llen = llen;
+            opt.indent = 2;
+            opt.horizontal = horizontal;
+            expect = render(nelem, names, &opt);
+            cols = mc_columns(nelem, names, &opt);
+
+            mc_widths_init(&stable);
+            opt.stable = &stable;
+            got = render(nelem, names, &opt);
+            if (strcmp(got, expect) != 0 || stable.cols != cols) {
+                printf("FAIL: stable first llen=%zu horizontal=%d\n", llen, horizontal);
+                ++errors;
+            }
+            free(got);
+            free(expect);
+
+            if (mc_columns(nelem, shorter, &opt) != cols) {
+                printf("FAIL: stable reuse llen=%zu horizontal=%d\n", llen, horizontal);
+                ++errors;
+            }
+
+            opt.stable = NULL;
+            expect = render(3, longer, &opt);
+            opt.stable = &stable;
+            got = render(3, longer, &opt);
+            if (strcmp(got, expect) != 0) {
+                printf("FAIL: stable overflow llen=%zu horizontal=%d\n", llen, horizontal);
+                ++errors;
+            }
+            free(got);
+            free(expect);
+            mc_widths_fini(&stable);
+        }
+    }
+    return (errors);
+}
+
+/*
+ * A layout kept in a cache is used again only for elements of the
+ * same lengths.  After an element shrinks, the output must be that of
+ * a fresh layout, not that of the columns it used to need.
+ */
+
+static int
+test_cache(void)
+{
+    static char pool[64];
+    size_t nelem = sizeof (names) / sizeof (*names);
+    const char **shrunk;
+    const char **same;
+    size_t llen;
+    size_t enr;
+    int errors;
+
+    memset(pool, 'y', sizeof (pool) - 1);
+    shrunk = (const char **) malloc(nelem * sizeof (*shrunk));
+    same = (const char **) malloc(nelem * sizeof (*same));
+    for (enr = 0; enr < nelem; ++enr) {
+        shrunk[enr] = strlen(names[enr]) > 8 ? "x" : names[enr];
+        same[enr] = pool + sizeof (pool) - 1 - strlen(names[enr]);
+    }
+
+    errors = 0;
+    for (llen = 20; llen <= 120; llen += 10) {
+        int mode;
+
+        for (mode = 0; mode <= 2; ++mode) {
+            const char **lists[3];
+            struct mc_cache cache;
+            mc_opt_t opt;
+            int k;
+
+            lists[0] = names;
+            lists[1] = shrunk;
+            lists[2] = same;
+            mc_opt_init(&opt);
+            opt.llen = llen;
+            opt.indent = 2;
+            opt.horizontal = (mode == 1);
+            opt.auto_orientation = (mode == 2);
+            mc_cache_init(&cache);
+            for (k = 0; k < 6; ++k) {
+                const char **elemv = lists[k % 3];
+                char *expect;
+                char *got;
+
+                opt.cache = NULL;
+                expect = render(nelem, elemv, &opt);
+                opt.cache = &cache;
+                got = render(nelem, elemv, &opt);
+                if (strcmp(got, expect) != 0 || cache.nelem != nelem) {
+                    printf("FAIL: cache llen=%zu mode=%d list=%d\n", llen, mode, k % 3);
+                    ++errors;
+                }
+                free(got);
+                free(expect);
+            }
+            mc_cache_fini(&cache);
+        }
+    }
+    free(shrunk);
+    free(same);
+    return (errors);
+}
+
+/*
+ * A fixed grid, fed one element at a time.
+ */
+
+static char *
+render_grid(size_t nelem, const char **elemv, const mc_opt_t *opt)
+{
+    mc_grid_t grid;
+    char *buf;
+    size_t sz;
+    size_t enr;
+    FILE *f;
+
+    f = open_memstream(&buf, &sz);
+    mc_grid_init(&grid, f, opt);
+    for (enr = 0; enr < nelem; ++enr) {
+        mc_grid_put(&grid, elemv[enr], strlen(elemv[enr]));
+    }
+    mc_grid_end(&grid);
+    fclose(f);
+    return (buf);
+}
+
+static int
+test_grid(void)
+{
+    static const char *elemv[] = {
+        "1", "2", "3", "a-long-one", "4", "5", "6", "7",
+    };
+    static const struct {
+        size_t llen;
+        size_t columns;
+        size_t col_width;
+        enum mc_overflow overflow;
+        const char *expect;
+    } cases[] = {
+        { 80, 3, 4, MC_OVERFLOW_TRUNCATE,
+            "  1     2     3\n"
+            "  a-lo  4     5\n"
+            "  6     7\n" },
+        { 80, 3, 4, MC_OVERFLOW_SPAN,
+            "  1     2     3\n"
+            "  a-long-one  4\n"
+            "  5     6     7\n" },
+        { 80, 4, 3, MC_OVERFLOW_SPAN,
+            "  1    2    3\n"
+            "  a-long-one     4\n"
+            "  5    6    7\n" },
+        { 20, 0, 4, MC_OVERFLOW_TRUNCATE,
+            "  1     2     3\n"
+            "  a-lo  4     5\n"
+            "  6     7\n" },
+        { 20, 2, 0, MC_OVERFLOW_TRUNCATE,
+            "  1         2\n"
+            "  3         a-long-o\n"
+            "  4         5\n"
+            "  6         7\n" },
+    };
+    size_t nelem = sizeof (elemv) / sizeof (*elemv);
+    size_t i;
+    int errors;
+
+    errors = 0;
+    for (i = 0; i < sizeof (cases) / sizeof (*cases); ++i) {
+        mc_opt_t opt;
+        char *got;
+
+        mc_opt_init(&opt);
+        opt.llen = cases[i].llen;
+        opt.indent = 2;
+        opt.columns = cases[i].columns;
+        opt.col_width = cases[i].col_width;
+        opt.overflow = cases[i].overflow;
+        got = render_grid(nelem, elemv, &opt);
+        if (strcmp(got, cases[i].expect) != 0) {
+            printf("FAIL: grid case %zu\n%s", i, got);
+            ++errors;
+        }
+        free(got);
+    }
+    return (errors);
+}
+
+/*
+ * Elements packed back to back, with no array of pointers to them,
+ * must print exactly as the same elements given by pointer.
+ */
+
+static int
+test_packed(void)
+{
+    size_t nelem = 5000;
+    const char **elemv;
+    size_t *lengths;
+    char *packed;
+    size_t off;
+    size_t enr;
+    size_t llen;
+    int errors;
+
+    elemv = (const char **) malloc(nelem * sizeof (*elemv));
+    lengths = (size_t *) malloc(nelem * sizeof (*lengths));
+    packed = (char *) malloc(nelem * 32);
+    srand(3);
+    off = 0;
+    for (enr = 0; enr < nelem; ++enr) {
+        size_t len = 1 + rand() % 24;
+        size_t i;
+
+        for (i = 0; i < len; ++i) {
+            packed[off + i] = 'a' + (enr + i) % 26;
+        }
+        elemv[enr] = packed + off;
+        lengths[enr] = len;
+        off += len;
+    }
+
+    errors = 0;
+    for (llen = 10; llen <= 250; llen += 60) {
+        int horizontal;
+
+        for (horizontal = 0; horizontal <= 1; ++horizontal) {
+            mc_opt_t opt;
+            char *expect;
+            char *got;
+
+            mc_opt_init(&opt);
+            opt.llen = llen;
+            opt.indent = 1;
+            opt.horizontal = horizontal;
+            opt.lengths = lengths;
+            expect = render(nelem, elemv, &opt);
+            opt.packed = packed;
+            got = render(nelem, NULL, &opt);
+            if (strcmp(got, expect) != 0) {
+                printf("FAIL: packed llen=%zu horizontal=%d\n", llen, horizontal);
+                ++errors;
+            }
+            free(got);
+            free(expect);
+        }
+    }
+
+    free(packed);
+    free(lengths);
+    free(elemv);
+    return (errors);
+}
+
+/*
+ * Following a list as it grows must give, at every point, the layout
+ * that the batch engines give for the elements so far.
+ */
+
+static int
+test_follow(void)
+{
+    size_t nelem = 3000;
+    const char **elemv;
+    size_t enr;
+    int horizontal;
+    int errors;
+
+    elemv = random_list(nelem, 4, 8, 100, 20, 40);
+
+    errors = 0;
+    for (horizontal = 0; horizontal <= 1; ++horizontal) {
+        size_t llen;
+
+        for (llen = 2; llen <= 200; llen += 33) {
+            mc_follow_t *fl;
+            mc_opt_t opt;
+
+            mc_opt_init(&opt);
+            opt.llen = llen;
+            opt.indent = llen % 5;
+            opt.horizontal = horizontal;
+            fl = mc_follow_new(&opt);
+            for (enr = 0; enr < nelem; ++enr) {
+                size_t n = enr + 1;
+
+                mc_follow_add(fl, strlen(elemv[enr]));
+                if (mc_follow_columns(fl) != mc_columns(n, elemv, &opt)) {
+                    printf("FAIL: follow columns nelem=%zu llen=%zu horizontal=%d\n",
+                        n, llen, horizontal);
+                    ++errors;
+                    break;
+                }
+                if (n % 97 == 0 || n == nelem) {
+                    char *expect = render(n, elemv, &opt);
+                    char *got;
+                    size_t sz;
+                    FILE *f;
+
+                    f = open_memstream(&got, &sz);
+                    mc_follow_print(fl, f, n, elemv, &opt);
+                    fclose(f);
+                    if (strcmp(got, expect) != 0) {
+                        printf("FAIL: follow print nelem=%zu llen=%zu horizontal=%d\n",
+                            n, llen, horizontal);
+                        ++errors;
+                    }
+                    free(got);
+                    free(expect);
+                }
+            }
+            mc_follow_free(fl);
+        }
+    }
+
+    free(elemv);
+    return (errors);
+}
+
+/*
+ * With a window, the layout must be, at every point, the one that
+ * the batch engines give for the last window elements alone.
+ */
+
+static int
+test_window(void)
+{
+    static const size_t windows[] = { 1, 7, 64, 250 };
+    size_t nelem = 1500;
+    const char **elemv;
+    size_t enr;
+    size_t wnr;
+    int horizontal;
+    int errors;
+
+    elemv = random_list(nelem, 5, 8, 50, 20, 40);
+
+    // A long run of ever shorter elements fills the deques
+    for (enr = 600; enr < 660; ++enr) {
+        elemv[enr] = x_string(660 - enr);
+    }
+
+    errors = 0;
+    for (wnr = 0; wnr < sizeof (windows) / sizeof (windows[0]); ++wnr) {
+        for (horizontal = 0; horizontal <= 1; ++horizontal) {
+            size_t llen;
+
+            for (llen = 2; llen <= 200; llen += 33) {
+                mc_follow_t *fl;
+                mc_opt_t opt;
+
+                mc_opt_init(&opt);
+                opt.llen = llen;
+                opt.indent = llen % 5;
+                opt.horizontal = horizontal;
+                opt.window = windows[wnr];
+                fl = mc_follow_new(&opt);
+                for (enr = 0; enr < nelem; ++enr) {
+                    size_t n = enr + 1;
+                    size_t start = n > opt.window ? n - opt.window : 0;
+
+                    mc_follow_add(fl, strlen(elemv[enr]));
+                    if (mc_follow_columns(fl) != mc_columns(n - start, elemv + start, &opt)) {
+                        printf("FAIL: window columns nelem=%zu window=%zu llen=%zu horizontal=%d\n",
+                            n, opt.window, llen, horizontal);
+                        ++errors;
+                        break;
+                    }
+                    if (n % 89 == 0 || n == nelem) {
+                        char *expect = render(n - start, elemv + start, &opt);
+                        char *got;
+                        size_t sz;
+                        FILE *f;
+
+                        f = open_memstream(&got, &sz);
+                        mc_follow_print(fl, f, n - start, elemv + start, &opt);
+                        fclose(f);
+                        if (strcmp(got, expect) != 0) {
+                            printf("FAIL: window print nelem=%zu window=%zu llen=%zu horizontal=%d\n",
+                                n, opt.window, llen, horizontal);
+                            ++errors;
+                        }
+                        free(got);
+                        free(expect);
+                    }
+                }
+                mc_follow_free(fl);
+            }
+        }
+    }
+
+    free(elemv);
+    return (errors);
+}
+
+/*
+ * Each plan from mc_plans() must be what a layout at its width alone
+ * would give: the same number of columns, rows and widths.
+ */
+
+static int
+test_plans(void)
+{
+    static const size_t llens[] = { 80, 1, 200, 5, 17, 40, 60, 80, 120, 2, 33 };
+    size_t nplans = sizeof (llens) / sizeof (llens[0]);
+    struct mc_plan plans[sizeof (llens) / sizeof (llens[0])];
+    size_t sizes[] = { 1, 3, 50, 700 };
+    const char **elemv;
+    size_t nelem = 700;
+    size_t snr;
+    size_t k;
+    int horizontal;
+    int errors;
+
+    elemv = random_list(nelem, 6, 9, 30, 15, 40);
+
+    errors = 0;
+    for (snr = 0; snr < sizeof (sizes) / sizeof (sizes[0]); ++snr) {
+        for (horizontal = 0; horizontal <= 1; ++horizontal) {
+            mc_opt_t opt;
+
+            mc_opt_init(&opt);
+            opt.indent = 3;
+            opt.horizontal = horizontal;
+            for (k = 0; k < nplans; ++k) {
+                plans[k].llen = llens[k];
+            }
+            mc_plans(sizes[snr], elemv, &opt, nplans, plans);
+
+            for (k = 0; k < nplans; ++k) {
+                struct mc_widths fresh;
+                size_t rows;
+
+                opt.llen = llens[k];
+                if (llens[k] <= opt.indent) {
+                    mc_plan_fini(&plans[k]);
+                    continue;
+                }
+
+                // A layout from scratch leaves its widths in fresh
+                mc_widths_init(&fresh);
+                opt.stable = &fresh;
+                free(render(sizes[snr], elemv, &opt));
+                opt.stable = NULL;
+
+                rows = (sizes[snr] + fresh.cols - 1) / fresh.cols;
+                if (plans[k].cols != fresh.cols || plans[k].rows != rows
+                    || (fresh.cols > 1 && memcmp(plans[k].widths, fresh.widths,
+                        fresh.cols * sizeof (*fresh.widths)) != 0)) {
+                    printf("FAIL: plan nelem=%zu llen=%zu horizontal=%d\n",
+                        sizes[snr], llens[k], horizontal);
+                    ++errors;
+                }
+                mc_widths_fini(&fresh);
+                mc_plan_fini(&plans[k]);
+            }
+        }
+    }
+
+    free(elemv);
+    return (errors);
+}
+
+/*
+ * The breakpoint table must give, for every display width,
+ * the same layout as mc_columns() at that width.
+ */
+
+static int
+test_breakpoints(void)
+{
+    size_t sizes[] = { 1, 3, 50, 700 };
+    size_t indents[] = { 0, 3 };
+    const char **elemv;
+    size_t nelem = 700;
+    size_t snr;
+    size_t inr;
+    int horizontal;
+    int errors;
+
+    elemv = random_list(nelem, 7, 9, 30, 15, 40);
+
+    errors = 0;
+    for (snr = 0; snr < sizeof (sizes) / sizeof (sizes[0]); ++snr) {
+        for (inr = 0; inr < sizeof (indents) / sizeof (indents[0]); ++inr) {
+            for (horizontal = 0; horizontal <= 1; ++horizontal) {
+                struct mc_plan *table;
+                size_t ntable;
+                size_t llen;
+                mc_opt_t opt;
+
+                mc_opt_init(&opt);
+                opt.llen = 250;
+                opt.indent = indents[inr];
+                opt.horizontal = horizontal;
+                table = mc_breakpoints(sizes[snr], elemv, &opt, &ntable);
+
+                for (llen = opt.indent + 1; llen <= 250; ++llen) {
+                    const struct mc_plan *plan = mc_breakpoint_find(table, ntable, llen);
+                    struct mc_widths fresh;
+
+                    opt.llen = llen;
+                    mc_widths_init(&fresh);
+                    opt.stable = &fresh;
+                    free(render(sizes[snr], elemv, &opt));
+                    opt.stable = NULL;
+
+                    if (plan->cols != fresh.cols
+                        || plan->rows != (sizes[snr] + fresh.cols - 1) / fresh.cols
+                        || (fresh.cols > 1 && memcmp(plan->widths, fresh.widths,
+                            fresh.cols * sizeof (*fresh.widths)) != 0)) {
+                        printf("FAIL: breakpoints nelem=%zu indent=%zu llen=%zu horizontal=%d\n",
+                            sizes[snr], opt.indent, llen, horizontal);
+                        ++errors;
+                    }
+                    mc_widths_fini(&fresh);
+                }
+                mc_breakpoints_free(table, ntable);
+            }
+        }
+    }
+
+    free(elemv);
+    return (errors);
+}
+
+/*
+ * mc_fit_rows() must find the same width as trying every width in
+ * turn, from the narrowest, until the layout has few enough rows.
+ */
+
+static int
+test_fit_rows(void)
+{
+    static const size_t max_rowsv[] = { 1, 2, 3, 5, 12, 40, 1000 };
+    size_t sizes[] = { 1, 3, 50, 700 };
+    size_t indents[] = { 0, 3, 10, 200 };
+    size_t rowsv[201];
+    const char **elemv;
+    size_t nelem = 700;
+    size_t snr;
+    size_t inr;
+    size_t rnr;
+    size_t enr;
+    int horizontal;
+    int errors;
+
+    elemv = random_list(nelem, 8, 9, 30, 15, 40);
+
+    // Short enough, at first, for candidates to tie
+    for (enr = 0; enr < 3; ++enr) {
+        elemv[enr] = x_string(1);
+    }
+
+    errors = 0;
+    for (snr = 0; snr < sizeof (sizes) / sizeof (sizes[0]); ++snr) {
+        for (inr = 0; inr < sizeof (indents) / sizeof (indents[0]); ++inr) {
+            for (horizontal = 0; horizontal <= 1; ++horizontal) {
+                mc_opt_t opt;
+                size_t llen;
+
+                mc_opt_init(&opt);
+                opt.indent = indents[inr];
+                opt.horizontal = horizontal;
+                for (llen = opt.indent + 1; llen <= 200; ++llen) {
+                    size_t cols;
+
+                    opt.llen = llen;
+                    cols = mc_columns(sizes[snr], elemv, &opt);
+                    rowsv[llen] = (sizes[snr] + cols - 1) / cols;
+                }
+
+                opt.llen = 200;
+                for (rnr = 0; rnr < sizeof (max_rowsv) / sizeof (max_rowsv[0]); ++rnr) {
+                    struct mc_plan plan;
+                    size_t want;
+                    int rv;
+
+                    for (want = opt.indent + 1; want <= 200; ++want) {
+                        if (rowsv[want] <= max_rowsv[rnr]) {
+                            break;
+                        }
+                    }
+                    rv = mc_fit_rows(sizes[snr], elemv, &opt, max_rowsv[rnr], &plan);
+                    if (want > 200 ? rv != ERANGE
+                        : rv != 0 || plan.llen != want || plan.rows != rowsv[want]) {
+                        printf("FAIL: fit_rows nelem=%zu indent=%zu max_rows=%zu horizontal=%d\n",
+                            sizes[snr], opt.indent, max_rowsv[rnr], horizontal);
+                        ++errors;
+                    }
+                    mc_plan_fini(&plan);
+                }
+            }
+        }
+    }
+
+    // With no room past the indentation, not even an empty list fits
+    for (snr = 0; snr < 2; ++snr) {
+        struct mc_plan plan;
+        mc_opt_t opt;
+
+        mc_opt_init(&opt);
+        opt.llen = 4;
+        opt.indent = 4;
+        if (mc_fit_rows(snr * 2, elemv, &opt, 3, &plan) != ERANGE) {
+            printf("FAIL: fit_rows nelem=%zu indent == llen\n", snr * 2);
+            ++errors;
+        }
+        mc_plan_fini(&plan);
+    }
+
+    free(elemv);
+    return (errors);
+}
+
+/*
+ * With auto orientation, the output must be that of whichever
+ * orientation, laid out on its own, takes fewer rows, then has
+ * the narrower lines, then is vertical.
+ */
+
+static size_t
+line_width(const struct mc_widths *w)
+{
+    size_t sum = 0;
+    size_t col;
+
+    for (col = 0; w->cols > 1 && col < w->cols; ++col) {
+        sum += w->widths[col];
+    }
+    return (sum);
+}
+
+static int
+test_orientation(void)
+{
+    static const size_t llens[] = { 10, 40, 80, 133, 200 };
+    size_t sizes[] = { 1, 2, 5, 17, 50, 700 };
+    const char **elemv;
+    size_t nelem = 700;
+    size_t snr;
+    size_t lnr;
+    int errors;
+
+    elemv = random_list(nelem, 9, 9, 30, 15, 40);
+
+    errors = 0;
+    for (snr = 0; snr < sizeof (sizes) / sizeof (sizes[0]); ++snr) {
+        for (lnr = 0; lnr < sizeof (llens) / sizeof (llens[0]); ++lnr) {
+            struct mc_widths vw;
+            struct mc_widths hw;
+            size_t vrows;
+            size_t hrows;
+            mc_opt_t opt;
+            char *want;
+            char *got;
+
+            mc_opt_init(&opt);
+            opt.llen = llens[lnr];
+            opt.indent = 2;
+
+            mc_widths_init(&vw);
+            opt.stable = &vw;
+            free(render(sizes[snr], elemv, &opt));
+            mc_widths_init(&hw);
+            opt.stable = &hw;
+            opt.horizontal = true;
+            free(render(sizes[snr], elemv, &opt));
+            opt.stable = NULL;
+
+            vrows = (sizes[snr] + vw.cols - 1) / vw.cols;
+            hrows = (sizes[snr] + hw.cols - 1) / hw.cols;
+            opt.horizontal = hrows < vrows
+                || (hrows == vrows && line_width(&hw) < line_width(&vw));
+            want = render(sizes[snr], elemv, &opt);
+
+            opt.horizontal = !opt.horizontal;
+            opt.auto_orientation = true;
+            got = render(sizes[snr], elemv, &opt);
+            if (strcmp(got, want) != 0
+                || mc_columns(sizes[snr], elemv, &opt) != (opt.horizontal ? vw.cols : hw.cols)) {
+                printf("FAIL: orientation nelem=%zu llen=%zu\n", sizes[snr], llens[lnr]);
+                ++errors;
+            }
+            free(got);
+            free(want);
+            mc_widths_fini(&vw);
+            mc_widths_fini(&hw);
+        }
+    }
+
+    free(elemv);
+    return (errors);
+}
+
+/*
+ * Uniform columns, laid out across rows, must come out as the fixed
+ * grid whose columns are as wide as the longest element, but for the
+ * padding that mc_print() leaves at the end of a short last row.
+ * Laid out down columns, they must be as many.
+ */
+
+static void
+strip_trailing_blanks(char *text)
+{
+    char *src;
+    char *dst;
+    char *blanks = NULL;
+
+    for (src = dst = text; *src; ++src) {
+        if (*src == ' ') {
+            if (blanks == NULL) {
+                blanks = dst;
+            }
+        }
+        else if (*src == '\n' && blanks != NULL) {
+            dst = blanks;
+            blanks = NULL;
+        }
+        else {
+            blanks = NULL;
+        }
+        *dst++ = *src;
+    }
+    *dst = '\0';
+}
+
+static int
+test_uniform(void)
+{
+    static const size_t llens[] = { 1, 10, 40, 80, 133 };
+    size_t sizes[] = { 1, 2, 5, 50, 700 };
+    const char **elemv;
+    size_t nelem = 700;
+    size_t snr;
+    size_t lnr;
+    size_t enr;
+    int errors;
+
+    elemv = random_list(nelem, 10, 9, 30, 15, 20);
+
+    errors = 0;
+    for (snr = 0; snr < sizeof (sizes) / sizeof (sizes[0]); ++snr) {
+        size_t max_len = 0;
+
+        for (enr = 0; enr < sizes[snr]; ++enr) {
+            size_t len = strlen(elemv[enr]);
+
+            max_len = len > max_len ? len : max_len;
+        }
+        for (lnr = 0; lnr < sizeof (llens) / sizeof (llens[0]); ++lnr) {
+            mc_opt_t opt;
+            mc_grid_t grid;
+            size_t cols;
+            char *want;
+            char *got;
+
+            mc_opt_init(&opt);
+            opt.llen = llens[lnr];
+            opt.indent = 2;
+            opt.col_width = max_len;
+            mc_grid_init(&grid, NULL, &opt);
+            want = render_grid(sizes[snr], elemv, &opt);
+
+            mc_opt_init(&opt);
+            opt.llen = llens[lnr];
+            opt.indent = 2;
+            opt.uniform = true;
+            opt.horizontal = true;
+            got = render(sizes[snr], elemv, &opt);
+            strip_trailing_blanks(got);
+            if (strcmp(got, want) != 0) {
+                printf("FAIL: uniform nelem=%zu llen=%zu\n%s", sizes[snr], llens[lnr], got);
+                ++errors;
+            }
+            free(got);
+            free(want);
+
+            opt.horizontal = false;
+            cols = grid.cols < sizes[snr] ? grid.cols : sizes[snr];
+            if (mc_columns(sizes[snr], elemv, &opt) != cols) {
+                printf("FAIL: uniform vertical nelem=%zu llen=%zu\n", sizes[snr], llens[lnr]);
+                ++errors;
+            }
+        }
+    }
+
+    free(elemv);
+    return (errors);
+}
+
+/*
+ * mc_plan_rows() must give ceil(nelem / rows) columns, each as wide
+ * as its longest element, however long, plus the two spaces after it.
+ */
+
+static int
+test_plan_rows(void)
+{
+    static const size_t rowsv[] = { 1, 2, 3, 7, 50, 1000 };
+    size_t sizes[] = { 1, 2, 5, 50, 700 };
+    const char **elemv;
+    size_t nelem = 700;
+    size_t snr;
+    size_t rnr;
+    size_t enr;
+    int horizontal;
+    int errors;
+
+    elemv = random_list(nelem, 11, 9, 30, 100, 190);
+
+    errors = 0;
+    for (snr = 0; snr < sizeof (sizes) / sizeof (sizes[0]); ++snr) {
+        for (rnr = 0; rnr < sizeof (rowsv) / sizeof (rowsv[0]); ++rnr) {
+            for (horizontal = 0; horizontal <= 1; ++horizontal) {
+                struct mc_plan plan;
+                size_t cols = (sizes[snr] + rowsv[rnr] - 1) / rowsv[rnr];
+                size_t rows = (sizes[snr] + cols - 1) / cols;
+                size_t widths[700];
+                size_t llen;
+                size_t col;
+                mc_opt_t opt;
+
+                memset(widths, 0, sizeof (widths));
+                for (enr = 0; enr < sizes[snr]; ++enr) {
+                    size_t len = strlen(elemv[enr]);
+
+                    col = horizontal ? enr % cols : enr / rows;
+                    widths[col] = len > widths[col] ? len : widths[col];
+                }
+                llen = 1;
+                for (col = 0; col < cols; ++col) {
+                    widths[col] += col + 1 == cols ? 0 : 2;
+                    widths[col] = widths[col] < 3 ? 3 : widths[col];
+                    llen += widths[col];
+                }
+
+                mc_opt_init(&opt);
+                opt.llen = 40;
+                opt.indent = 1;
+                opt.horizontal = horizontal;
+                if (mc_plan_rows(sizes[snr], elemv, &opt, rowsv[rnr], &plan) != 0
+                    || plan.cols != cols || plan.rows != rows || plan.rows > rowsv[rnr]
+                    || plan.llen != llen
+                    || memcmp(plan.widths, widths, cols * sizeof (*widths)) != 0) {
+                    printf("FAIL: plan_rows nelem=%zu rows=%zu horizontal=%d\n",
+                        sizes[snr], rowsv[rnr], horizontal);
+                    ++errors;
+                }
+                mc_plan_fini(&plan);
+            }
+        }
+    }
+
+    free(elemv);
+    return (errors);
+}
+
+/*
+ * mc_plan() must give the layout that printing uses: the widths
+ * that printing leaves in a kept mc_widths, and, with auto
+ * orientation, the orientation whose output printing matches.
+ */
+
+static int
+test_plan(void)
+{
+    static const size_t llens[] = { 10, 40, 80, 200 };
+    size_t sizes[] = { 1, 5, 50, 700 };
+    const char **elemv;
+    size_t nelem = 700;
+    size_t snr;
+    size_t lnr;
+    int mode;
+    int errors;
+
+    elemv = random_list(nelem, 12, 9, 30, 15, 40);
+
+    errors = 0;
+    for (snr = 0; snr < sizeof (sizes) / sizeof (sizes[0]); ++snr) {
+        for (lnr = 0; lnr < sizeof (llens) / sizeof (llens[0]); ++lnr) {
+            // Vertical, horizontal, auto, uniform
+            for (mode = 0; mode < 4; ++mode) {
+                struct mc_widths fresh;
+                struct mc_plan plan;
+                mc_opt_t opt;
+                char *want;
+                char *got;
+
+                mc_opt_init(&opt);
+                opt.llen = llens[lnr];
+                opt.indent = 2;
+                opt.horizontal = (mode == 1);
+                opt.auto_orientation = (mode == 2);
+                opt.uniform = (mode == 3);
+                mc_plan(sizes[snr], elemv, &opt, &plan);
+
+                mc_widths_init(&fresh);
+                opt.stable = &fresh;
+                want = render(sizes[snr], elemv, &opt);
+                opt.stable = NULL;
+                opt.auto_orientation = false;
+                opt.horizontal = plan.horizontal;
+                got = render(sizes[snr], elemv, &opt);
+
+                if (plan.cols != fresh.cols
+                    || plan.rows != (sizes[snr] + fresh.cols - 1) / fresh.cols
+                    || (fresh.cols > 1 && memcmp(plan.widths, fresh.widths,
+                        fresh.cols * sizeof (*fresh.widths)) != 0)
+                    || strcmp(got, want) != 0) {
+                    printf("FAIL: plan nelem=%zu llen=%zu mode=%d\n",
+                        sizes[snr], llens[lnr], mode);
+                    ++errors;
+                }
+                free(got);
+                free(want);
+                mc_widths_fini(&fresh);
+                mc_plan_fini(&plan);
+            }
+        }
+    }
+
+    free(elemv);
+    return (errors);
+}
+
+/*
+ * mc_write() must write exactly what mc_print() prints, including
+ * when elements are given by length, and are not nul-terminated,
+ * and when it splices into a pipe.
+ */
+
+static int
+test_write(void)
+{
+    static const char text[] = "alpha,be,gamma-delta,e,zeta,eta,theta-iota-kappa,mu";
+    const char *elemv[64];
+    size_t lengths[64];
+    size_t nelem;
+    const char *p;
+    size_t llen;
+    int errors;
+
+    nelem = 0;
+    for (p = text; *p; ) {
+        const char *comma = strchr(p, ',');
+        size_t len = comma ? (size_t) (comma - p) : strlen(p);
+
+        elemv[nelem] = p;
+        lengths[nelem] = len;
+        ++nelem;
+        p += len + (comma != NULL);
+    }
+
+    errors = 0;
+    for (llen = 1; llen <= 100; llen += 3) {
+        int horizontal;
+
+        for (horizontal = 0; horizontal <= 1; ++horizontal) {
+            char tmpl[] = "/tmp/mc-test.XXXXXX";
+            mc_opt_t opt;
+            char *expect;
+            char got[4096];
+            ssize_t n;
+            int fd;
+
+            mc_opt_init(&opt);
+            opt.llen = llen;
+            opt.indent = llen % 3;
+            opt.horizontal = horizontal;
+            opt.lengths = lengths;
+            expect = render(nelem, elemv, &opt);
+
+            fd = mkstemp(tmpl);
+            unlink(tmpl);
+            if (fd < 0 || mc_write(fd, nelem, elemv, &opt) != 0) {
+                printf("FAIL: mc_write llen=%zu\n", llen);
+                ++errors;
+            }
+            else {
+                n = pread(fd, got, sizeof (got) - 1, 0);
+                got[n < 0 ? 0 : n] = '\0';
+                if (strcmp(got, expect) != 0) {
+                    printf("FAIL: mc_write llen=%zu horizontal=%d\n", llen, horizontal);
+                    ++errors;
+                }
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+
+            /*
+             * The same, through a pipe, with vmsplice().
+             * The output is small enough to fit in the pipe.
+             */
+            {
+                int pfd[2];
+
+                opt.splice = true;
+                if (pipe(pfd) != 0 || mc_write(pfd[1], nelem, elemv, &opt) != 0) {
+                    printf("FAIL: mc_write splice llen=%zu\n", llen);
+                    ++errors;
+                }
+                else {
+                    close(pfd[1]);
+                    n = read(pfd[0], got, sizeof (got) - 1);
+                    got[n < 0 ? 0 : n] = '\0';
+                    if (strcmp(got, expect) != 0) {
+                        printf("FAIL: mc_write splice llen=%zu horizontal=%d\n", llen, horizontal);
+                        ++errors;
+                    }
+                    close(pfd[0]);
+                }
+            }
+            free(expect);
+        }
+    }
+
+    return (errors);
+}
+
+/*
+ * Compare mc_find_byte() against a plain loop, at every alignment
+ * of start and end, and every position of the byte sought.
+ */
+
+static int
+test_find_byte(void)
+{
+    static char buf[256];
+    size_t start;
+    size_t end;
+    size_t pos;
+    int errors;
+
+    memset(buf, 'x', sizeof (buf));
+    errors = 0;
+
+    for (start = 0; start < 72; ++start) {
+        for (end = start; end < sizeof (buf); end += 1 + end % 7) {
+            for (pos = start; pos <= end; ++pos) {
+                const char *expect = buf + pos;
+                const char *found;
+
+                if (pos < end) {
+                    buf[pos] = '\n';
+                }
+                found = mc_find_byte(buf + start, buf + end, '\n');
+                buf[pos] = 'x';
+                if (found != expect) {
+                    printf("mc_find_byte: start=%zu end=%zu pos=%zu: got %td\n",
+                        start, end, pos, found - buf);
+                    ++errors;
+                }
+            }
+        }
+    }
+
+    return (errors);
+}
 
 int
 main()
 {
     size_t nelem = sizeof (names) / sizeof (*names);
+    int errors;
 
     printf("Test vertical.\n");
-    mc(stdout, nelem, names, 80, false);
+    mc(stdout, nelem, names, 80, 0, false);
 
     printf("Test horizontal.\n");
-    mc(stdout, nelem, names, 80, true);
+    mc(stdout, nelem, names, 80, 0, true);
+
+    printf("Test engines.\n");
+    errors = test_engines();
+
+    printf("Test threads.\n");
+    errors += test_threads();
+
+    printf("Test write.\n");
+    errors += test_write();
+
+    printf("Test max_rows.\n");
+    errors += test_max_rows();
+
+    printf("Test stable widths.\n");
+    errors += test_stable();
+
+    printf("Test cache.\n");
+    errors += test_cache();
+
+    printf("Test grid.\n");
+    errors += test_grid();
+
+    printf("Test packed.\n");
+    errors += test_packed();
+
+    printf("Test follow.\n");
+    errors += test_follow();
+
+    printf("Test window.\n");
+    errors += test_window();
+
+    printf("Test plans.\n");
+    errors += test_plans();
+
+    printf("Test breakpoints.\n");
+    errors += test_breakpoints();
+
+    printf("Test fit rows.\n");
+    errors += test_fit_rows();
+
+    printf("Test orientation.\n");
+    errors += test_orientation();
+
+    printf("Test uniform.\n");
+    errors += test_uniform();
+
+    printf("Test plan rows.\n");
+    errors += test_plan_rows();
+
+    printf("Test plan.\n");
+    errors += test_plan();
+
+    printf("Test find_byte (%s).\n", mc_simd_variant());
+    errors += test_find_byte();
+    if (errors != 0) {
+        printf("%d failures.\n", errors);
+        return (1);
+    }
+    printf("OK\n");
     return (0);
 }